@@ -0,0 +1,743 @@
+#ifndef _ASYNCCLIENT_HPP_
+#define _ASYNCCLIENT_HPP_
+
+#include <future>
+#include <utility>
+
+#include <boost/enable_shared_from_this.hpp>
+
+#include <httpclient.hpp>
+
+typedef boost::function<void(const HTTPResponse&)> HTTPResponseHandler;
+
+/** Check a finished response the way the blocking calls always have,
+ * printing what went wrong on behalf of caller. */
+inline bool check_response(const char *caller, const std::string &server, const std::string &port, const HTTPResponse &response, bool printheaders) {
+    if (is_timeout(response.ec)) {
+        printf("%s : request to server %s on port %s timed out : %s\n", caller, server.c_str(), port.c_str(), response.ec.message().c_str());
+        return false;
+    }
+
+    if (response.ec) {
+        printf("%s : error requesting from server %s on port %s : %s\n", caller, server.c_str(), port.c_str(), response.ec.message().c_str());
+        return false;
+    }
+
+    if (!valid_status(response.nStatus, response.headers, printheaders))
+        return false;
+
+    if (printheaders)
+        printf("%s\n", response.headers.c_str());
+
+    if (response.body.empty()) {
+        printf("%s : null message body\n", caller);
+        return false;
+    }
+
+    return true;
+}
+
+/** A single request driven entirely by asynchronous operations on the pool's
+ * io_service: connection checkout, DNS lookup, connect, handshake, write and
+ * read each hand off to the next step from their completion handler, so no
+ * thread is tied up while the request is in flight.
+ *
+ * The request's timeouts are timers on the same io_service. One which goes
+ * off (or the request's cancel signal) closes the connection under whatever
+ * operation is pending, and the error that operation completes with is
+ * reported as the timeout (or operation_aborted) instead.
+ * Like the rest of the request this assumes its handlers never run at the
+ * same time, i.e. one thread runs the io_service (as HTTPClientEngine
+ * does). */
+class AsyncHTTPRequest : public boost::enable_shared_from_this<AsyncHTTPRequest> {
+    public:
+        AsyncHTTPRequest(HTTPConnectionPool &poolIn, const std::string &serverIn, const std::string &portIn, const HTTPRequest &requestIn, bool fUseSSLIn, HTTPResponseHandler handlerIn) : pool(poolIn), server(serverIn), port(portIn), request(requestIn), handler(handlerIn), phaseTimer(poolIn.GetIOService()), totalTimer(poolIn.GetIOService()) {
+            fUseSSL = fUseSSLIn;
+            fReused = false;
+            fWaiting = false;
+            fComplete = false;
+            nPhase = 0;
+            nLatency = std::chrono::microseconds(0);
+            nFed = 0;
+        }
+
+        void Start() {
+            std::chrono::steady_clock::time_point end = request.GetTimeouts().End(std::chrono::steady_clock::now());
+            if (end != std::chrono::steady_clock::time_point()) {
+                totalTimer.expires_at(end);
+                totalTimer.async_wait(boost::bind(&AsyncHTTPRequest::handle_timeout, shared_from_this(), HTTP_TIMEOUT_TOTAL, 0, boost::asio::placeholders::error));
+            }
+
+            if (request.GetCancel())
+                request.GetCancel()->Connect(boost::bind(&AsyncHTTPRequest::post_cancel, shared_from_this()));
+
+            acquire();
+        }
+
+    private:
+        /* Write every part of the request at once. TLS would make a record
+         * of each part, so there they are gathered into sb_ first. */
+        template <typename Handler>
+        void async_write(Handler h) {
+            if (fUseSSL) {
+                sb_.commit(boost::asio::buffer_copy(sb_.prepare(request.Size()), request.GetBuffers()));
+                boost::asio::async_write(conn->stream, sb_, h);
+            } else {
+                boost::asio::async_write(conn->stream.next_layer(), request.GetBuffers(), h);
+            }
+        }
+
+        template <typename Handler>
+        void async_read_until(const std::string &delimeter, Handler h) {
+            if (fUseSSL)
+                boost::asio::async_read_until(conn->stream, sb_, delimeter, h);
+            else
+                boost::asio::async_read_until(conn->stream.next_layer(), sb_, delimeter, h);
+        }
+
+        template <typename Buffers, typename CompletionCondition, typename Handler>
+        void async_read(Buffers &&buffers, CompletionCondition condition, Handler h) {
+            if (fUseSSL)
+                boost::asio::async_read(conn->stream, std::forward<Buffers>(buffers), condition, h);
+            else
+                boost::asio::async_read(conn->stream.next_layer(), std::forward<Buffers>(buffers), condition, h);
+        }
+
+        void acquire() {
+            fWaiting = true;
+            pool.AsyncAcquire(server, port, fUseSSL, boost::bind(&AsyncHTTPRequest::handle_acquire, shared_from_this(), _1, _2));
+        }
+
+        /* Time the next phase, nTimeout of 0 just ends the current one. */
+        void begin_phase(HTTPTimeoutError phase, unsigned int nTimeout) {
+            end_phase();
+            if (!nTimeout)
+                return;
+
+            phaseTimer.expires_after(std::chrono::milliseconds(nTimeout));
+            phaseTimer.async_wait(boost::bind(&AsyncHTTPRequest::handle_timeout, shared_from_this(), phase, nPhase, boost::asio::placeholders::error));
+        }
+
+        void end_phase() {
+            nPhase++;
+            phaseTimer.cancel();
+        }
+
+        /* Cancel may come from any thread, the request is only touched on
+         * its own. */
+        void post_cancel() {
+            boost::asio::post(pool.GetIOService(), boost::bind(&AsyncHTTPRequest::abort, shared_from_this(), boost::system::error_code(boost::asio::error::operation_aborted)));
+        }
+
+        void handle_timeout(HTTPTimeoutError /*phase*/, unsigned int /*nPhaseIn*/, const boost::system::error_code &/*ec*/);
+        void abort(const boost::system::error_code &/*reason*/);
+        void handle_acquire(boost::shared_ptr<HTTPConnection> connIn, bool fReusedIn);
+        void handle_resolve(const boost::system::error_code &ec, const std::vector<boost::asio::ip::tcp::endpoint> &endpoints);
+        void handle_connect(const boost::system::error_code &ec);
+        void handle_handshake(const boost::system::error_code &ec);
+        void start_write();
+        void handle_write(const boost::system::error_code &ec);
+        void handle_read_head(const boost::system::error_code &ec);
+        void handle_read_body(const boost::system::error_code &ec);
+        void handle_read_chunk(const boost::system::error_code &ec);
+        void handle_read_staged(const boost::system::error_code &ec);
+        void finish_body();
+
+        /** A reused connection which fails before any response arrives was
+         * most likely closed by the server while idle, start over on another. */
+        bool retry_stale() {
+            if (!fReused || sb_.size() != 0 || aborted)
+                return false;
+
+            pool.Release(conn, false, false);
+            conn.reset();
+            sb_.consume(sb_.size());
+            acquire();
+            return true;
+        }
+
+        /* Pass whatever has been added to the body since the last call on to
+         * the JSON reader and the request's sink, which takes the body
+         * instead of the response. Returns false once the request is over. */
+        bool deliver() {
+            if (reader && body.size() > nFed && !reader->feed(body.data() + nFed, body.size() - nFed))
+                reader.reset(); // Not JSON after all, ParseJSON will say so.
+            nFed = body.size();
+
+            const HTTPBodySink &sink = request.GetBodySink();
+            if (!sink || body.empty())
+                return true;
+
+            bool fOk = sink(body.data(), body.size());
+            body.clear();
+            nFed = 0;
+            if (!fOk)
+                complete(boost::system::errc::make_error_code(boost::system::errc::operation_canceled));
+
+            return fOk;
+        }
+
+        void complete(const boost::system::error_code &/*ec*/, bool fReusable = false);
+
+        HTTPConnectionPool &pool;
+        const std::string server;
+        const std::string port;
+        const HTTPRequest request;
+        HTTPResponseHandler handler;
+        bool fUseSSL;
+        bool fReused;
+        boost::shared_ptr<HTTPConnection> conn;
+        HTTPResponseHead head;
+        HTTPChunkedDecoder decoder;
+        HTTPContentDecoder content;
+        /** Compressed bytes still to come, -1 when the body runs to EOF. */
+        long long nLeft;
+        /** Dechunked data waiting to be decompressed. */
+        std::string chunk;
+        boost::asio::streambuf sb_;
+        /** The body, read straight into the string handed out in the
+         * response. */
+        std::string body;
+        /** Parses a 200 response's body as it arrives when the request asks
+         * for it (HTTPRequest::SetParseJSON), along with how much of the body
+         * it has been given. */
+        boost::shared_ptr<json_spirit::Push_reader<json_spirit::Value> > reader;
+        std::size_t nFed;
+        boost::shared_ptr<const json_spirit::Value> json;
+        boost::asio::steady_timer phaseTimer;
+        boost::asio::steady_timer totalTimer;
+        /** When the request finished being written, and how long after that
+         * the response head took, see HTTPResponse::nLatency. */
+        std::chrono::steady_clock::time_point written;
+        std::chrono::microseconds nLatency;
+        /** Bumped whenever a phase ends, so a phase timer which goes off
+         * after being replaced is ignored. */
+        unsigned int nPhase;
+        /** Set while waiting on the pool or the resolver rather than on the
+         * connection, a timeout then has nothing to close. */
+        bool fWaiting;
+        bool fComplete;
+        /** Why the request was given up on, reported in place of the error
+         * the operation it interrupted completes with. */
+        boost::system::error_code aborted;
+};
+
+void AsyncHTTPRequest::handle_timeout(HTTPTimeoutError phase, unsigned int nPhaseIn, const boost::system::error_code &ec) {
+    if (ec || (phase != HTTP_TIMEOUT_TOTAL && nPhaseIn != nPhase))
+        return;
+
+    abort(make_timeout_error(phase));
+}
+
+void AsyncHTTPRequest::abort(const boost::system::error_code &reason) {
+    if (fComplete || aborted)
+        return;
+
+    aborted = reason;
+    if (fWaiting) {
+        complete(reason);
+        return;
+    }
+
+    // The pending operation fails and completes the request.
+    conn->Close(false);
+}
+
+void AsyncHTTPRequest::handle_acquire(boost::shared_ptr<HTTPConnection> connIn, bool fReusedIn) {
+    if (fComplete) { // Timed out waiting, the connection was never used.
+        if (connIn)
+            pool.Release(connIn, fReusedIn);
+        return;
+    }
+
+    fWaiting = false;
+    if (!connIn) { // The pool has been shut down.
+        complete(boost::asio::error::operation_aborted);
+        return;
+    }
+
+    conn = connIn;
+    fReused = fReusedIn;
+    if (fReused) {
+        start_write();
+        return;
+    }
+
+    begin_phase(HTTP_TIMEOUT_RESOLVE, request.GetTimeouts().nResolve);
+    fWaiting = true;
+    HTTPResolverCache::Global().AsyncResolve(pool.GetIOService(), server, port, boost::bind(&AsyncHTTPRequest::handle_resolve, shared_from_this(), _1, _2));
+}
+
+void AsyncHTTPRequest::handle_resolve(const boost::system::error_code &ec, const std::vector<boost::asio::ip::tcp::endpoint> &endpointsIn) {
+    if (fComplete)
+        return;
+
+    fWaiting = false;
+    if (ec) {
+        complete(ec);
+        return;
+    }
+
+    /* Shutting the pool down closed the connection while nothing was open on
+     * it, connecting now would hold up the shutdown until the connect ends. */
+    if (pool.IsShutdown()) {
+        complete(boost::asio::error::operation_aborted);
+        return;
+    }
+
+    begin_phase(HTTP_TIMEOUT_CONNECT, request.GetTimeouts().nConnect);
+    conn->AsyncConnect(endpointsIn, boost::bind(&AsyncHTTPRequest::handle_connect, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void AsyncHTTPRequest::handle_connect(const boost::system::error_code &ec) {
+    if (ec) {
+        /* The cached addresses may be stale, look them up again next time,
+         * unless it was us who gave up on them. */
+        if (!aborted && ec != boost::asio::error::operation_aborted)
+            HTTPResolverCache::Global().Invalidate(server, port);
+        complete(ec);
+        return;
+    }
+
+    boost::system::error_code ignored;
+    conn->stream.lowest_layer().set_option(boost::asio::ip::tcp::no_delay(true), ignored);
+
+    if (!fUseSSL) {
+        start_write();
+        return;
+    }
+
+    begin_phase(HTTP_TIMEOUT_HANDSHAKE, request.GetTimeouts().nHandshake);
+    conn->BeginHandshake();
+    conn->stream.async_handshake(boost::asio::ssl::stream_base::client, boost::bind(&AsyncHTTPRequest::handle_handshake, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void AsyncHTTPRequest::handle_handshake(const boost::system::error_code &ec) {
+    conn->EndHandshake(ec);
+    if (ec) {
+        complete(ec);
+        return;
+    }
+
+    start_write();
+}
+
+void AsyncHTTPRequest::start_write() {
+    begin_phase(HTTP_TIMEOUT_FIRST_BYTE, request.GetTimeouts().nFirstByte);
+    async_write(boost::bind(&AsyncHTTPRequest::handle_write, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void AsyncHTTPRequest::handle_write(const boost::system::error_code &ec) {
+    if (ec) {
+        sb_.consume(sb_.size());
+        if (!retry_stale())
+            complete(ec);
+
+        return;
+    }
+
+    written = std::chrono::steady_clock::now();
+    async_read_until("\r\n\r\n", boost::bind(&AsyncHTTPRequest::handle_read_head, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void AsyncHTTPRequest::handle_read_head(const boost::system::error_code &ec) {
+    // Don't go on to parse a response nobody wants any more.
+    if (aborted) {
+        complete(aborted);
+        return;
+    }
+
+    if (ec) {
+        if (!retry_stale())
+            complete(ec);
+
+        return;
+    }
+
+    end_phase();
+    nLatency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - written);
+    if (!head.Parse(sb_)) {
+        complete(boost::system::errc::make_error_code(boost::system::errc::protocol_error));
+        return;
+    }
+
+    /* Skip any interim responses to get to the real one. The server has
+     * answered, so the connection wasn't stale whatever happens next. */
+    if (head.IsInterim()) {
+        fReused = false;
+        async_read_until("\r\n\r\n", boost::bind(&AsyncHTTPRequest::handle_read_head, shared_from_this(), boost::asio::placeholders::error));
+        return;
+    }
+
+    if (!head.HasBody(request.GetHead())) {
+        head.fChunked = false;
+        head.nContentLength = 0;
+        complete(ec, head.fKeepAlive && sb_.size() == 0);
+        return;
+    }
+
+    if (!content.Init(head.strContentEncoding)) {
+        complete(boost::system::errc::make_error_code(boost::system::errc::not_supported));
+        return;
+    }
+
+    if (request.GetParseJSON() && head.nStatus == 200)
+        reader = boost::make_shared<json_spirit::Push_reader<json_spirit::Value> >();
+
+    if (head.fChunked) {
+        decoder.Reset();
+        handle_read_chunk(ec);
+    } else if (content.IsActive() || reader || request.GetBodySink()) {
+        /* Compressed bodies are decompressed a read at a time, and bodies
+         * which are parsed or handed on as they arrive are taken a read at a
+         * time too. */
+        if (head.nContentLength < 0)
+            head.fKeepAlive = false;
+        nLeft = head.nContentLength;
+        handle_read_staged(ec);
+    } else if (head.nContentLength >= 0) {
+        /* Take what came in with the head and read the rest directly into
+         * the body, which is handed over whole in the response. */
+        std::size_t nHave = std::min((std::size_t)head.nContentLength, sb_.size());
+        body.assign(boost::asio::buffer_cast<const char*>(sb_.data()), nHave);
+        sb_.consume(nHave);
+        handle_read_body(ec);
+    } else {
+        // Without a length the body runs until the server closes the connection.
+        head.fKeepAlive = false;
+        body.assign(boost::asio::buffer_cast<const char*>(sb_.data()), sb_.size());
+        sb_.consume(sb_.size());
+        async_read(boost::asio::dynamic_buffer(body), boost::asio::transfer_all(), boost::bind(&AsyncHTTPRequest::handle_read_body, shared_from_this(), boost::asio::placeholders::error));
+    }
+}
+
+void AsyncHTTPRequest::handle_read_body(const boost::system::error_code &ec) {
+    if (head.nContentLength < 0) {
+        if (ec != boost::asio::error::eof) {
+            complete(ec);
+            return;
+        }
+
+        complete(boost::system::error_code());
+        return;
+    }
+
+    if (ec) {
+        complete(ec);
+        return;
+    }
+
+    // Room is made for the rest a step at a time, see NextRead.
+    if (body.size() < (std::size_t)head.nContentLength) {
+        std::size_t nRead = head.NextRead(body.size());
+        body.resize(body.size() + nRead);
+        async_read(boost::asio::buffer(&body[body.size() - nRead], nRead), boost::asio::transfer_all(), boost::bind(&AsyncHTTPRequest::handle_read_body, shared_from_this(), boost::asio::placeholders::error));
+        return;
+    }
+
+    // Anything past the announced body means we've lost track of framing.
+    complete(ec, head.fKeepAlive && sb_.size() == 0);
+}
+
+/* Decode whatever has arrived and only go back for more while the decoder
+ * still needs it. */
+void AsyncHTTPRequest::handle_read_chunk(const boost::system::error_code &ec) {
+    if (aborted) {
+        complete(aborted);
+        return;
+    }
+
+    const char *data = boost::asio::buffer_cast<const char*>(sb_.data());
+    sb_.consume(decoder.Decode(data, sb_.size(), content.IsActive() ? chunk : body));
+    if (decoder.IsError() || !content.Decode(chunk.data(), chunk.size(), body)) {
+        complete(boost::system::errc::make_error_code(boost::system::errc::protocol_error));
+        return;
+    }
+    chunk.clear();
+    if (!deliver())
+        return;
+
+    if (decoder.IsDone()) {
+        finish_body();
+        return;
+    }
+
+    if (ec) {
+        complete(ec);
+        return;
+    }
+
+    async_read(sb_, boost::asio::transfer_at_least(1), boost::bind(&AsyncHTTPRequest::handle_read_chunk, shared_from_this(), boost::asio::placeholders::error));
+}
+
+/* Decompress the body as each read completes, nLeft counts down the length
+ * when there is one. */
+void AsyncHTTPRequest::handle_read_staged(const boost::system::error_code &ec) {
+    if (aborted) {
+        complete(aborted);
+        return;
+    }
+
+    std::size_t size = nLeft >= 0 ? std::min((std::size_t)nLeft, sb_.size()) : sb_.size();
+    if (!content.Decode(boost::asio::buffer_cast<const char*>(sb_.data()), size, body)) {
+        complete(boost::system::errc::make_error_code(boost::system::errc::bad_message));
+        return;
+    }
+
+    sb_.consume(size);
+    if (nLeft >= 0)
+        nLeft -= size;
+    if (!deliver())
+        return;
+
+    if (nLeft == 0 || (nLeft < 0 && ec == boost::asio::error::eof)) {
+        finish_body();
+        return;
+    }
+
+    if (ec) {
+        complete(ec);
+        return;
+    }
+
+    async_read(sb_, boost::asio::transfer_at_least(1), boost::bind(&AsyncHTTPRequest::handle_read_staged, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void AsyncHTTPRequest::finish_body() {
+    if (content.IsActive() && !content.Finish()) {
+        complete(boost::system::errc::make_error_code(boost::system::errc::bad_message));
+        return;
+    }
+
+    if (reader && reader->finish()) {
+        // Swap the value out rather than copy it.
+        boost::shared_ptr<json_spirit::Value> value = boost::make_shared<json_spirit::Value>();
+        std::swap(*value, reader->get_value());
+        json = value;
+    }
+
+    complete(boost::system::error_code(), head.fKeepAlive && sb_.size() == 0);
+}
+
+void AsyncHTTPRequest::complete(const boost::system::error_code &ec, bool fReusable) {
+    fComplete = true;
+    end_phase();
+    totalTimer.cancel();
+    if (request.GetCancel())
+        request.GetCancel()->Disconnect();
+    if (conn) {
+        if (fReusable)
+            conn->nRequests++;
+        pool.Release(conn, fReusable, !ec);
+        conn.reset();
+    }
+
+    HTTPResponse response;
+    // Whatever an operation failed with after abort closed its connection.
+    response.ec = ec && aborted ? aborted : ec;
+    if (!ec) {
+        response.nStatus = head.nStatus;
+        response.headers.swap(head.headers);
+        response.index = head.index;
+        response.body.swap(body);
+        response.json = json;
+        response.nLatency = nLatency;
+    }
+
+    handler(response);
+}
+
+/** One request of a batch. */
+struct HTTPBatchItem {
+    HTTPBatchItem() : fUseSSL(false) {}
+    HTTPBatchItem(const std::string &serverIn, const std::string &portIn, const HTTPRequest &requestIn, bool fUseSSLIn) : server(serverIn), port(portIn), request(requestIn), fUseSSL(fUseSSLIn) {}
+
+    std::string server;
+    std::string port;
+    HTTPRequest request;
+    bool fUseSSL;
+};
+
+/** Called as each request of a batch completes, with its index in the batch. */
+typedef boost::function<void(std::size_t, const HTTPResponse&)> HTTPBatchHandler;
+
+/** Anything asynchronous requests can be issued through. */
+class HTTPRequester {
+    public:
+        virtual ~HTTPRequester() {}
+
+        /** Start a request, handler is called (from an io_service thread) with
+         * the response once it completes or fails. */
+        virtual void AsyncRequest(const std::string &/*server*/, const std::string &/*port*/, const HTTPRequest &/*request*/, bool fUseSSL, HTTPResponseHandler /*handler*/) = 0;
+
+        /** AsyncRequest, returning a handle which can cancel the request from
+         * any thread. Cancelling aborts whatever the request is waiting on;
+         * the handler is still called, with operation_aborted. */
+        HTTPRequestHandle StartRequest(const std::string &server, const std::string &port, const HTTPRequest &request, bool fUseSSL, HTTPResponseHandler handler) {
+            HTTPRequest cancellable(request);
+            HTTPRequestHandle handle = cancellable.MakeCancellable();
+            AsyncRequest(server, port, cancellable, fUseSSL, handler);
+            return handle;
+        }
+
+        /** AsyncRequest, handing the body to sink as it is read rather than
+         * collecting it, see HTTPRequest::SetBodySink. The response handler
+         * still gets the head, with an empty body. */
+        void AsyncStreamingRequest(const std::string &server, const std::string &port, const HTTPRequest &request, bool fUseSSL, HTTPBodySink sink, HTTPResponseHandler handler) {
+            HTTPRequest streamed(request);
+            streamed.SetBodySink(sink);
+            AsyncRequest(server, port, streamed, fUseSSL, handler);
+        }
+
+        /** Start a request and get a future for its response. Waiting on the
+         * future from an io_service thread which drives the request will
+         * deadlock. */
+        std::future<HTTPResponse> Request(const std::string &server, const std::string &port, const HTTPRequest &request, bool fUseSSL) {
+            boost::shared_ptr<std::promise<HTTPResponse> > promise = boost::make_shared<std::promise<HTTPResponse> >();
+            AsyncRequest(server, port, request, fUseSSL, boost::bind(&HTTPRequester::fulfill, promise, _1));
+            return promise->get_future();
+        }
+
+        /** Run a batch of requests with at most nMaxInFlight (0 for no limit)
+         * outstanding at once. handler gets each response in completion order
+         * (one call at a time) and done is called once all of them have been
+         * handled. Every item gets its own response, failures included. */
+        void AsyncBatch(const std::vector<HTTPBatchItem> &/*items*/, unsigned int nMaxInFlight, HTTPBatchHandler /*handler*/, boost::function<void()> done = boost::function<void()>());
+
+        /** Run a batch of requests as AsyncBatch does and wait for every
+         * response, returned in the same order as items. The same deadlock
+         * caveat as Request applies. */
+        std::vector<HTTPResponse> Batch(const std::vector<HTTPBatchItem> &/*items*/, unsigned int nMaxInFlight);
+
+    private:
+        static void fulfill(boost::shared_ptr<std::promise<HTTPResponse> > promise, const HTTPResponse &response) {
+            promise->set_value(response);
+        }
+
+        static void gather(boost::shared_ptr<std::vector<HTTPResponse> > responses, std::size_t i, const HTTPResponse &response) {
+            (*responses)[i] = response;
+        }
+
+        static void finish(boost::shared_ptr<std::promise<void> > promise) {
+            promise->set_value();
+        }
+};
+
+/** State of a batch started by HTTPRequester::AsyncBatch, kept alive by the
+ * requests it has in flight. A new request is started each time one
+ * completes until the whole batch has been issued. */
+class HTTPBatch : public boost::enable_shared_from_this<HTTPBatch> {
+    public:
+        HTTPBatch(HTTPRequester &requesterIn, const std::vector<HTTPBatchItem> &itemsIn, unsigned int nMaxInFlightIn, HTTPBatchHandler handlerIn, boost::function<void()> doneIn) : requester(requesterIn), items(itemsIn), handler(handlerIn), done(doneIn) {
+            nMaxInFlight = nMaxInFlightIn ? nMaxInFlightIn : items.size();
+            nNext = 0;
+            nInFlight = 0;
+            nDone = 0;
+        }
+
+        void Start() {
+            if (items.empty()) {
+                if (done)
+                    done();
+                return;
+            }
+
+            launch();
+        }
+
+    private:
+        void launch();
+        void handle_response(std::size_t i, const HTTPResponse &response);
+
+        HTTPRequester &requester;
+        const std::vector<HTTPBatchItem> items;
+        HTTPBatchHandler handler;
+        boost::function<void()> done;
+        std::size_t nMaxInFlight;
+
+        boost::mutex mutex;
+        std::size_t nNext;
+        std::size_t nInFlight;
+        std::size_t nDone;
+        /* Responses can complete on several threads at once, the handler is
+         * only ever called from one at a time. */
+        boost::mutex handler_mutex;
+};
+
+/* Claim as many items as the limit allows and start them. The requests are
+ * started without the lock held since a requester which can't take them
+ * (e.g. a stopped engine) completes them straight away. */
+void HTTPBatch::launch() {
+    std::vector<std::size_t> start;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        while (nNext < items.size() && nInFlight < nMaxInFlight) {
+            start.push_back(nNext++);
+            nInFlight++;
+        }
+    }
+
+    for (std::size_t n = 0; n < start.size(); n++) {
+        const HTTPBatchItem &item = items[start[n]];
+        requester.AsyncRequest(item.server, item.port, item.request, item.fUseSSL, boost::bind(&HTTPBatch::handle_response, shared_from_this(), start[n], _1));
+    }
+}
+
+void HTTPBatch::handle_response(std::size_t i, const HTTPResponse &response) {
+    {
+        boost::lock_guard<boost::mutex> lock(handler_mutex);
+        handler(i, response);
+    }
+
+    bool fFinished;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        nInFlight--;
+        fFinished = ++nDone == items.size();
+    }
+
+    if (!fFinished) {
+        launch();
+        return;
+    }
+
+    if (done)
+        done();
+}
+
+void HTTPRequester::AsyncBatch(const std::vector<HTTPBatchItem> &items, unsigned int nMaxInFlight, HTTPBatchHandler handler, boost::function<void()> done) {
+    boost::shared_ptr<HTTPBatch> batch = boost::make_shared<HTTPBatch>(boost::ref(*this), items, nMaxInFlight, handler, done);
+    batch->Start();
+}
+
+std::vector<HTTPResponse> HTTPRequester::Batch(const std::vector<HTTPBatchItem> &items, unsigned int nMaxInFlight) {
+    boost::shared_ptr<std::vector<HTTPResponse> > responses = boost::make_shared<std::vector<HTTPResponse> >(items.size());
+    boost::shared_ptr<std::promise<void> > promise = boost::make_shared<std::promise<void> >();
+    std::future<void> finished = promise->get_future();
+    AsyncBatch(items, nMaxInFlight, boost::bind(&HTTPRequester::gather, responses, _1, _2), boost::bind(&HTTPRequester::finish, promise));
+    finished.wait();
+
+    return *responses;
+}
+
+/** Issues asynchronous requests over a connection pool. Everything runs on the
+ * pool's io_service, which the caller is responsible for running; a single
+ * thread running it can drive any number of requests at once. */
+class AsyncHTTPClient : public HTTPRequester {
+    public:
+        AsyncHTTPClient(HTTPConnectionPool &poolIn) : pool(poolIn) {}
+
+        void AsyncRequest(const std::string &server, const std::string &port, const HTTPRequest &request, bool fUseSSL, HTTPResponseHandler handler) {
+            boost::shared_ptr<AsyncHTTPRequest> req = boost::make_shared<AsyncHTTPRequest>(boost::ref(pool), server, port, request, fUseSSL, handler);
+            req->Start();
+        }
+
+        boost::asio::io_service &GetIOService() {
+            return pool.GetIOService();
+        }
+
+    private:
+        HTTPConnectionPool &pool;
+};
+
+#endif // _ASYNCCLIENT_HPP_
@@ -0,0 +1,88 @@
+#ifndef _CANCEL_HPP_
+#define _CANCEL_HPP_
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+/** Lets a request be abandoned from any thread. Whatever is running the
+ * request connects a slot which stops it; Cancel runs that slot (at most
+ * once), straight away when the request is already running or as soon as it
+ * connects otherwise. */
+class HTTPCancelSignal {
+    public:
+        typedef boost::function<void()> Slot;
+
+        HTTPCancelSignal() : fCancelled(false) {}
+
+        void Cancel() {
+            Slot run;
+            {
+                boost::lock_guard<boost::mutex> lock(mutex);
+                if (fCancelled)
+                    return;
+
+                fCancelled = true;
+                run.swap(slot);
+            }
+
+            // Not under the lock, the slot may well disconnect itself.
+            if (run)
+                run();
+        }
+
+        bool IsCancelled() {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            return fCancelled;
+        }
+
+        /** Set what cancelling does, replacing any earlier slot. Runs it
+         * straight away if the signal has already been cancelled. */
+        void Connect(Slot slotIn) {
+            {
+                boost::lock_guard<boost::mutex> lock(mutex);
+                if (!fCancelled) {
+                    slot = slotIn;
+                    return;
+                }
+            }
+
+            slotIn();
+        }
+
+        /** Drop the slot once the request is over, along with anything it
+         * keeps alive. */
+        void Disconnect() {
+            Slot old;
+            boost::lock_guard<boost::mutex> lock(mutex);
+            old.swap(slot);
+        }
+
+    private:
+        boost::mutex mutex;
+        bool fCancelled;
+        Slot slot;
+};
+
+/** What a caller keeps to cancel a request it has started, from any thread.
+ * Copies all cancel the same request. A request which is cancelled fails
+ * with operation_aborted, unless its response was already complete. */
+class HTTPRequestHandle {
+    public:
+        HTTPRequestHandle() {}
+        explicit HTTPRequestHandle(boost::shared_ptr<HTTPCancelSignal> signalIn) : signal(signalIn) {}
+
+        void Cancel() {
+            if (signal)
+                signal->Cancel();
+        }
+
+        bool IsCancelled() const {
+            return signal && signal->IsCancelled();
+        }
+
+    private:
+        boost::shared_ptr<HTTPCancelSignal> signal;
+};
+
+#endif // _CANCEL_HPP_
@@ -0,0 +1,182 @@
+#ifndef _CLIENTENGINE_HPP_
+#define _CLIENTENGINE_HPP_
+
+#ifdef __linux__
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+#include <atomic>
+#include <vector>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <asyncclient.hpp>
+
+struct HTTPEngineOptions {
+    HTTPEngineOptions() : nThreads(0), nMaxPerHost(8), nIdleTimeout(30) {}
+
+    /** Number of io_service threads, 0 for one per hardware thread. */
+    unsigned int nThreads;
+    /** CPU to pin each thread to, in thread order. Threads past the end of the
+     * list (or every thread when it is empty) are left unpinned. */
+    std::vector<int> vCPUAffinity;
+    /** Connection limit and idle timeout for each thread's pool. */
+    unsigned int nMaxPerHost;
+    unsigned int nIdleTimeout;
+};
+
+/** Owns N io_service threads and spreads requests across them round robin.
+ *
+ * Every thread has its own connection pool which is only ever touched from
+ * that thread, so checking connections in and out takes no locks. The cost is
+ * that idle connections aren't shared between threads and the per-host
+ * connection limit applies to each thread separately. */
+class HTTPClientEngine : public HTTPRequester {
+    public:
+        HTTPClientEngine(TLSContext &/*context*/, const HTTPEngineOptions &options = HTTPEngineOptions());
+
+        ~HTTPClientEngine() {
+            Stop();
+        }
+
+        void AsyncRequest(const std::string &/*server*/, const std::string &/*port*/, const HTTPRequest &/*request*/, bool fUseSSL, HTTPResponseHandler /*handler*/);
+
+        /** Stop the engine: requests still in flight are aborted and complete
+         * with operation_aborted, as does anything submitted afterwards. Blocks
+         * until every thread has finished, so it must not be called from one
+         * of them. */
+        void Stop();
+
+        /** Pool counters summed across every thread, must not be called from
+         * one of the engine's threads. */
+        HTTPPoolStats GetStats();
+
+        unsigned int GetThreadCount() {
+            return shards.size();
+        }
+
+    private:
+        struct Shard {
+            Shard(TLSContext &context, const HTTPEngineOptions &options) : work(new boost::asio::io_service::work(io_service)), pool(io_service, context, options.nMaxPerHost, options.nIdleTimeout, false), client(pool) {}
+
+            boost::asio::io_service io_service;
+            boost::scoped_ptr<boost::asio::io_service::work> work;
+            HTTPConnectionPool pool;
+            AsyncHTTPClient client;
+            boost::scoped_ptr<boost::thread> thread;
+        };
+
+        static void run_shard(Shard *shard, int nCPU);
+        static void fail(HTTPResponseHandler handler) {
+            HTTPResponse response;
+            response.ec = boost::asio::error::operation_aborted;
+            handler(response);
+        }
+
+        std::vector<boost::shared_ptr<Shard> > shards;
+        std::atomic<unsigned int> nNext;
+        /* Requests part way through being posted to a shard; Stop waits for
+         * these to drain so nothing is posted after a shard has finished. */
+        std::atomic<unsigned int> nSubmitting;
+        std::atomic<bool> fStopping;
+        boost::mutex stop_mutex;
+        bool fStopped;
+};
+
+HTTPClientEngine::HTTPClientEngine(TLSContext &context, const HTTPEngineOptions &options) : nNext(0), nSubmitting(0), fStopping(false), fStopped(false) {
+    unsigned int nThreads = options.nThreads;
+    if (nThreads == 0)
+        nThreads = boost::thread::hardware_concurrency();
+    if (nThreads == 0)
+        nThreads = 1;
+
+    for (unsigned int i = 0; i < nThreads; i++) {
+        boost::shared_ptr<Shard> shard = boost::make_shared<Shard>(boost::ref(context), options);
+        int nCPU = i < options.vCPUAffinity.size() ? options.vCPUAffinity[i] : -1;
+        shard->thread.reset(new boost::thread(boost::bind(&HTTPClientEngine::run_shard, shard.get(), nCPU)));
+        shards.push_back(shard);
+    }
+}
+
+void HTTPClientEngine::run_shard(Shard *shard, int nCPU) {
+#ifdef __linux__
+    if (nCPU >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(nCPU, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+            printf("HTTPClientEngine::run_shard : unable to pin thread to cpu %d\n", nCPU);
+    }
+#else
+    (void)nCPU;
+#endif
+
+    shard->io_service.run();
+}
+
+void HTTPClientEngine::AsyncRequest(const std::string &server, const std::string &port, const HTTPRequest &request, bool fUseSSL, HTTPResponseHandler handler) {
+    nSubmitting++;
+    if (fStopping) {
+        nSubmitting--;
+        fail(handler);
+        return;
+    }
+
+    /* The request starts on the shard's own thread, so everything touching its
+     * pool happens there. */
+    Shard &shard = *shards[nNext++ % shards.size()];
+    void (AsyncHTTPClient::*start)(const std::string&, const std::string&, const HTTPRequest&, bool, HTTPResponseHandler) = &AsyncHTTPClient::AsyncRequest;
+    shard.io_service.post(boost::bind(start, &shard.client, server, port, request, fUseSSL, handler));
+    nSubmitting--;
+}
+
+void HTTPClientEngine::Stop() {
+    boost::lock_guard<boost::mutex> lock(stop_mutex);
+    if (fStopped)
+        return;
+
+    fStopping = true;
+    while (nSubmitting > 0)
+        boost::this_thread::yield();
+
+    /* Closing every connection aborts whatever is in flight; once those
+     * requests have completed each thread runs out of work and exits. */
+    for (std::size_t i = 0; i < shards.size(); i++) {
+        shards[i]->io_service.post(boost::bind(&HTTPConnectionPool::Shutdown, &shards[i]->pool));
+        shards[i]->work.reset();
+    }
+
+    for (std::size_t i = 0; i < shards.size(); i++)
+        shards[i]->thread->join();
+
+    fStopped = true;
+}
+
+HTTPPoolStats HTTPClientEngine::GetStats() {
+    boost::lock_guard<boost::mutex> lock(stop_mutex);
+    HTTPPoolStats total = HTTPPoolStats();
+    for (std::size_t i = 0; i < shards.size(); i++) {
+        /* The pools are only safe to read from their own threads, so ask each
+         * one for its counters unless it has already stopped. */
+        HTTPPoolStats stats;
+        if (fStopped) {
+            stats = shards[i]->pool.GetStats();
+        } else {
+            std::packaged_task<HTTPPoolStats()> task(boost::bind(&HTTPConnectionPool::GetStats, &shards[i]->pool));
+            std::future<HTTPPoolStats> result = task.get_future();
+            shards[i]->io_service.post(boost::bind(&std::packaged_task<HTTPPoolStats()>::operator(), &task));
+            stats = result.get();
+        }
+
+        total.nHits += stats.nHits;
+        total.nMisses += stats.nMisses;
+        total.nEvictions += stats.nEvictions;
+        total.nIdle += stats.nIdle;
+    }
+
+    return total;
+}
+
+#endif // _CLIENTENGINE_HPP_
@@ -0,0 +1,245 @@
+#ifndef _COALESCING_HPP_
+#define _COALESCING_HPP_
+
+#include <stdint.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <asyncclient.hpp>
+
+struct HTTPCoalesceStats {
+    /** Requests which could be coalesced (GET or HEAD). */
+    uint64_t nRequests;
+    /** Requests actually passed on. */
+    uint64_t nFetches;
+    /** Requests which were answered by another identical one already in
+     * flight. */
+    uint64_t nCoalesced;
+};
+
+/** Identical requests in flight together, all answered by the one response. */
+struct HTTPFlight {
+    HTTPFlight() : nWaiting(0), signal(boost::make_shared<HTTPCancelSignal>()) {}
+
+    /** One per request, cleared once the request has been answered or
+     * cancelled. */
+    std::vector<HTTPResponseHandler> handlers;
+    /** The callers' own cancel signals, in the same order. */
+    std::vector<boost::shared_ptr<HTTPCancelSignal> > cancels;
+    /** Each caller's total timeout, if it has one, in the same order. */
+    std::vector<boost::shared_ptr<HTTPAlarm> > alarms;
+    std::size_t nWaiting;
+    /** Cancels the request passed on, once nobody is waiting for it. */
+    boost::shared_ptr<HTTPCancelSignal> signal;
+};
+
+/** Collapses identical GET and HEAD requests made while one of them is
+ * already in flight into that one request (single flight), so a burst of
+ * callers asking for the same thing, typically just as it drops out of a
+ * cache, costs one connection and one transfer.
+ *
+ * Requests are identical when they go to the same server and port the same
+ * way and are the same down to the last header. Every caller is handed the
+ * same response, and JSON bodies are parsed once before they are, the parsed
+ * value being shared and never modified. A caller cancelling only gives up
+ * its own wait; the request itself is cancelled once every caller has.
+ *
+ * Timeouts are kept per caller. The per phase ones are part of what makes
+ * requests identical, since they can only be applied to the one request
+ * passed on. The total timeout and deadline aren't, as two callers would
+ * hardly ever have the same deadline: the request is passed on without them,
+ * and each caller instead has an alarm which ends its own wait with
+ * HTTP_TIMEOUT_TOTAL the way cancelling would, so a caller in a hurry never
+ * waits longer for having joined one with more time.
+ *
+ * Goes in front of an HTTPCachingClient rather than behind it, so the
+ * response is stored once rather than once per caller:
+ *
+ *     HTTPCachingClient cached(engine, cache);
+ *     HTTPCoalescingClient client(cached); */
+class HTTPCoalescingClient : public HTTPRequester {
+    public:
+        HTTPCoalescingClient(HTTPRequester &innerIn) : inner(innerIn), stats(HTTPCoalesceStats()) {}
+
+        void AsyncRequest(const std::string &/*server*/, const std::string &/*port*/, const HTTPRequest &/*request*/, bool fUseSSL, HTTPResponseHandler /*handler*/);
+
+        HTTPCoalesceStats GetStats() {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            return stats;
+        }
+
+    private:
+        void handle_response(const std::string &/*key*/, boost::shared_ptr<HTTPFlight> /*flight*/, const HTTPResponse &/*response*/);
+        void cancel_waiter(const std::string &/*key*/, boost::shared_ptr<HTTPFlight> /*flight*/, std::size_t i, const boost::system::error_code &/*ec*/);
+
+        HTTPRequester &inner;
+
+        boost::mutex mutex;
+        boost::unordered_map<std::string, boost::shared_ptr<HTTPFlight> > flights;
+        HTTPCoalesceStats stats;
+};
+
+void HTTPCoalescingClient::AsyncRequest(const std::string &server, const std::string &port, const HTTPRequest &request, bool fUseSSL, HTTPResponseHandler handler) {
+    boost::string_view method = request.GetMethod();
+    // A streamed body goes to the sink of the request which asked for it.
+    if ((method != "GET" && method != "HEAD") || request.GetBodySink()) {
+        inner.AsyncRequest(server, port, request, fUseSSL, handler);
+        return;
+    }
+
+    std::string key;
+    key.reserve(server.size() + port.size() + request.Size() + 4);
+    key.append(fUseSSL ? "s " : "  ");
+    key.append(server);
+    key.append(" ", 1);
+    key.append(port);
+    key.append(" ", 1);
+    const HTTPTimeouts &timeouts = request.GetTimeouts();
+    if (timeouts.nResolve || timeouts.nConnect || timeouts.nHandshake || timeouts.nFirstByte) {
+        key.append(std::to_string(timeouts.nResolve) + "," + std::to_string(timeouts.nConnect) + "," + std::to_string(timeouts.nHandshake) + "," + std::to_string(timeouts.nFirstByte));
+        key.append(" ", 1);
+    }
+    key.append(request.ToString());
+
+    boost::shared_ptr<HTTPFlight> flight;
+    std::size_t i;
+    bool fFirst = false;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        stats.nRequests++;
+        boost::shared_ptr<HTTPFlight> &slot = flights[key];
+        if (!slot) {
+            slot = boost::make_shared<HTTPFlight>();
+            fFirst = true;
+            stats.nFetches++;
+        } else {
+            stats.nCoalesced++;
+        }
+
+        flight = slot;
+        i = flight->handlers.size();
+        flight->handlers.push_back(handler);
+        flight->cancels.push_back(request.GetCancel());
+        flight->alarms.push_back(boost::shared_ptr<HTTPAlarm>());
+        flight->nWaiting++;
+    }
+
+    /* Armed after the lock is dropped, the alarm can go off straight away;
+     * cancel_waiter doesn't mind being called before it is stored. */
+    std::chrono::steady_clock::time_point end = timeouts.End(std::chrono::steady_clock::now());
+    if (end != std::chrono::steady_clock::time_point()) {
+        boost::shared_ptr<HTTPAlarm> alarm = HTTPWatchdog::Global().Arm(end, boost::bind(&HTTPCoalescingClient::cancel_waiter, this, key, flight, i, make_timeout_error(HTTP_TIMEOUT_TOTAL)));
+        boost::lock_guard<boost::mutex> lock(mutex);
+        if (flight->handlers[i])
+            flight->alarms[i] = alarm;
+    }
+
+    // Not under the lock, an already cancelled signal runs the slot straight away.
+    if (request.GetCancel())
+        request.GetCancel()->Connect(boost::bind(&HTTPCoalescingClient::cancel_waiter, this, key, flight, i, boost::system::error_code(boost::asio::error::operation_aborted)));
+
+    if (!fFirst)
+        return;
+
+    HTTPRequest shared(request);
+    shared.SetCancel(flight->signal);
+    // Timed per caller instead, see above.
+    HTTPTimeouts phases(timeouts);
+    phases.nTotal = 0;
+    phases.deadline = std::chrono::steady_clock::time_point();
+    shared.SetTimeouts(phases);
+    inner.AsyncRequest(server, port, shared, fUseSSL, boost::bind(&HTTPCoalescingClient::handle_response, this, key, flight, _1));
+}
+
+void HTTPCoalescingClient::handle_response(const std::string &key, boost::shared_ptr<HTTPFlight> flight, const HTTPResponse &response) {
+    std::vector<HTTPResponseHandler> handlers;
+    std::vector<boost::shared_ptr<HTTPCancelSignal> > cancels;
+    std::vector<boost::shared_ptr<HTTPAlarm> > alarms;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        boost::unordered_map<std::string, boost::shared_ptr<HTTPFlight> >::iterator it = flights.find(key);
+        if (it != flights.end() && it->second == flight)
+            flights.erase(it);
+
+        handlers.swap(flight->handlers);
+        cancels.swap(flight->cancels);
+        alarms.swap(flight->alarms);
+        flight->nWaiting = 0;
+    }
+
+    for (std::size_t i = 0; i < cancels.size(); i++) {
+        if (cancels[i])
+            cancels[i]->Disconnect();
+        // Not under the lock, an alarm going off holds its own while it waits for ours.
+        if (alarms[i])
+            alarms[i]->Disarm();
+    }
+
+    std::size_t nWaiting = 0;
+    for (std::size_t i = 0; i < handlers.size(); i++) {
+        if (handlers[i])
+            nWaiting++;
+    }
+
+    /* Parsed here once rather than by every caller, each of which gets its
+     * own copy of the response but shares the one parsed value. */
+    const HTTPResponse *shared = &response;
+    HTTPResponse parsed;
+    if (nWaiting > 1 && !response.ec && !response.json && boost::algorithm::icontains(response.GetHeader(HEADER_CONTENT_TYPE), "json")) {
+        parsed = response;
+        parsed.ParseJSON();
+        shared = &parsed;
+    }
+
+    for (std::size_t i = 0; i < handlers.size(); i++) {
+        if (handlers[i])
+            handlers[i](*shared);
+    }
+}
+
+/* A caller giving up or running out of time, the others may still want the
+ * response. */
+void HTTPCoalescingClient::cancel_waiter(const std::string &key, boost::shared_ptr<HTTPFlight> flight, std::size_t i, const boost::system::error_code &ec) {
+    HTTPResponseHandler handler;
+    boost::shared_ptr<HTTPCancelSignal> cancel;
+    boost::shared_ptr<HTTPAlarm> alarm;
+    bool fAbandon = false;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        if (i >= flight->handlers.size() || !flight->handlers[i])
+            return;
+
+        handler.swap(flight->handlers[i]);
+        cancel.swap(flight->cancels[i]);
+        alarm.swap(flight->alarms[i]);
+        if (--flight->nWaiting == 0) {
+            boost::unordered_map<std::string, boost::shared_ptr<HTTPFlight> >::iterator it = flights.find(key);
+            if (it != flights.end() && it->second == flight)
+                flights.erase(it);
+            fAbandon = true;
+        }
+    }
+
+    /* Whichever of the two didn't end the wait is let go of. The alarm is
+     * the one running when timed out, disarming it from here would deadlock. */
+    if (ec == boost::asio::error::operation_aborted) {
+        if (alarm)
+            alarm->Disarm();
+    } else if (cancel) {
+        cancel->Disconnect();
+    }
+
+    if (fAbandon)
+        flight->signal->Cancel();
+
+    HTTPResponse response;
+    response.ec = ec;
+    handler(response);
+}
+
+#endif // _COALESCING_HPP_
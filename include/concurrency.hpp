@@ -0,0 +1,305 @@
+#ifndef _CONCURRENCY_HPP_
+#define _CONCURRENCY_HPP_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <asyncclient.hpp>
+
+struct HTTPConcurrencyPolicy {
+    HTTPConcurrencyPolicy() : nInitial(10), nMin(1), nMax(200), dBackoff(0.9), dTolerance(1.5), nMaxQueue(1000) {}
+
+    /** Requests allowed in flight to a host before anything is known. */
+    unsigned int nInitial;
+    unsigned int nMin;
+    unsigned int nMax;
+    /** What the limit is multiplied by when the host shows signs of
+     * overload. */
+    double dBackoff;
+    /** How many times its best latency a request can take before the host
+     * counts as overloaded. */
+    double dTolerance;
+    /** Requests which can wait for a slot per host, any more fail straight
+     * away with resource_unavailable_try_again. */
+    unsigned int nMaxQueue;
+};
+
+struct HTTPConcurrencyStats {
+    uint64_t nRequests;
+    /** Requests which had to wait for a slot. */
+    uint64_t nQueued;
+    /** Requests failed because the queue was full. */
+    uint64_t nRejected;
+    /** Times a limit was cut for overload. */
+    uint64_t nBackoffs;
+};
+
+/** The controller's view of a host. */
+struct HTTPConcurrencyState {
+    /** Requests allowed in flight, as a fraction since it grows by less than
+     * one request at a time. */
+    double dLimit;
+    std::size_t nInFlight;
+    std::size_t nQueued;
+    /** Best latency seen lately, what the host manages when not loaded. */
+    std::chrono::microseconds nBaseline;
+    /** Moving average of latency. */
+    std::chrono::microseconds nLatency;
+};
+
+/** Limits how many requests are in flight to each host, finding the limit as
+ * it goes the way TCP finds a congestion window (AIMD) instead of it being
+ * fixed:
+ *
+ *  - a request which comes back in under dTolerance times the best latency
+ *    the host has shown lately, while the limit is being used, raises the
+ *    limit by 1/limit, i.e. by one for each limit's worth of requests;
+ *  - one which takes longer, fails, or gets a 429 or 503, cuts the limit by
+ *    dBackoff, at most once per round trip so a burst of slow responses
+ *    from one spell of overload only counts once.
+ *
+ * Latency is the server's own time to answer (HTTPResponse::nLatency) when
+ * the requester measures it, so a request which had to open a connection,
+ * which is how the limit gets past the connections already open, isn't
+ * taken for one the host was slow to answer.
+ *
+ * Requests over the limit wait in a queue per host, up to nMaxQueue of them,
+ * and go out as others finish; those beyond that fail without reaching a
+ * socket. Wraps any HTTPRequester:
+ *
+ *     HTTPConcurrencyLimiter limited(engine);
+ *     limited.AsyncRequest(server, port, request, true, handler); */
+class HTTPConcurrencyLimiter : public HTTPRequester {
+    public:
+        HTTPConcurrencyLimiter(HTTPRequester &innerIn, const HTTPConcurrencyPolicy &policyIn = HTTPConcurrencyPolicy()) : inner(innerIn), policy(policyIn), stats(HTTPConcurrencyStats()) {
+            nNextId = 0;
+        }
+
+        void AsyncRequest(const std::string &/*server*/, const std::string &/*port*/, const HTTPRequest &/*request*/, bool fUseSSL, HTTPResponseHandler /*handler*/);
+
+        HTTPConcurrencyStats GetStats() {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            return stats;
+        }
+
+        HTTPConcurrencyState GetState(const std::string &/*server*/, const std::string &/*port*/);
+
+    private:
+        /* Latencies the baseline can be reset from, see record. */
+        enum { BASELINE_WINDOW = 256 };
+
+        struct Pending {
+            uint64_t nId;
+            std::string server;
+            std::string port;
+            HTTPRequest request;
+            bool fUseSSL;
+            HTTPResponseHandler handler;
+            /** Requests in flight to the host once this one is sent. */
+            std::size_t nInFlight;
+        };
+
+        struct Host {
+            Host() : dLimit(0), nInFlight(0), nSamples(0), nBaseline(0), nWindowMin(0), dLatency(0) {}
+
+            double dLimit;
+            std::size_t nInFlight;
+            std::deque<Pending> queue;
+            uint64_t nSamples;
+            /** Best latency seen, in microseconds. */
+            int64_t nBaseline;
+            /** Best latency in the current window. */
+            int64_t nWindowMin;
+            /** Moving average, in microseconds. */
+            double dLatency;
+            /** No backoff until then, a round trip after the last. */
+            std::chrono::steady_clock::time_point holdoff;
+        };
+
+        /* Called with mutex held. */
+        Host &host(const std::string &server, const std::string &port) {
+            Host &h = hosts[server + ":" + port];
+            if (h.dLimit == 0)
+                h.dLimit = policy.nInitial;
+
+            return h;
+        }
+
+        void release(Host &/*h*/, std::vector<Pending> &/*ready*/);
+        void record(Host &/*h*/, std::chrono::microseconds /*latency*/, std::size_t nInFlight, bool fOverload);
+
+        void send(Pending &/*pending*/);
+        void handle_response(const std::string &/*key*/, std::chrono::steady_clock::time_point /*start*/, std::size_t nInFlight, HTTPResponseHandler /*handler*/, const HTTPResponse &/*response*/);
+        void cancel_pending(const std::string &/*key*/, uint64_t nId);
+
+        HTTPRequester &inner;
+        const HTTPConcurrencyPolicy policy;
+
+        boost::mutex mutex;
+        std::map<std::string, Host> hosts;
+        uint64_t nNextId;
+        HTTPConcurrencyStats stats;
+};
+
+void HTTPConcurrencyLimiter::release(Host &h, std::vector<Pending> &ready) {
+    while (!h.queue.empty() && h.nInFlight < (std::size_t)h.dLimit) {
+        h.nInFlight++;
+        h.queue.front().nInFlight = h.nInFlight;
+        ready.push_back(h.queue.front());
+        h.queue.pop_front();
+    }
+}
+
+void HTTPConcurrencyLimiter::record(Host &h, std::chrono::microseconds latency, std::size_t nInFlight, bool fOverload) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    int64_t nLatency = std::max<int64_t>(latency.count(), 1);
+    if (!fOverload) {
+        h.nBaseline = h.nBaseline == 0 ? nLatency : std::min(h.nBaseline, nLatency);
+        h.nWindowMin = h.nWindowMin == 0 ? nLatency : std::min(h.nWindowMin, nLatency);
+        /* The baseline only ever falls while the host is loaded, since under
+         * load every latency is above it. A whole window spent at the
+         * smallest limit is as unloaded as the host gets though, so if it is
+         * still slower, that is the host's speed now. */
+        if (++h.nSamples % BASELINE_WINDOW == 0) {
+            if (h.dLimit < policy.nMin + 1)
+                h.nBaseline = h.nWindowMin;
+            h.nWindowMin = 0;
+        }
+
+        h.dLatency = h.dLatency == 0 ? nLatency : h.dLatency * 0.9 + nLatency * 0.1;
+        fOverload = nLatency > policy.dTolerance * h.nBaseline;
+    }
+
+    if (fOverload) {
+        if (now < h.holdoff)
+            return;
+
+        h.dLimit = std::max<double>(h.dLimit * policy.dBackoff, policy.nMin);
+        h.holdoff = now + std::chrono::microseconds((int64_t)std::max<double>(h.dLatency, nLatency));
+        stats.nBackoffs++;
+        return;
+    }
+
+    // A limit which isn't being reached says nothing about how high it could go.
+    if (nInFlight * 2 >= h.dLimit)
+        h.dLimit = std::min<double>(h.dLimit + 1 / h.dLimit, policy.nMax);
+}
+
+void HTTPConcurrencyLimiter::AsyncRequest(const std::string &server, const std::string &port, const HTTPRequest &request, bool fUseSSL, HTTPResponseHandler handler) {
+    std::vector<Pending> ready;
+    uint64_t nId;
+    bool fQueued = false;
+    bool fRejected = false;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        stats.nRequests++;
+        nId = nNextId++;
+    }
+
+    /* Once queued, another request finishing can send this one on another
+     * thread, so connecting afterwards could replace the slot it was sent
+     * with. Not under the lock, a cancelled signal runs the slot at once. */
+    if (request.GetCancel())
+        request.GetCancel()->Connect(boost::bind(&HTTPConcurrencyLimiter::cancel_pending, this, server + ":" + port, nId));
+
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        Host &h = host(server, port);
+        if (h.queue.size() >= policy.nMaxQueue && h.nInFlight >= (std::size_t)h.dLimit) {
+            stats.nRejected++;
+            fRejected = true;
+        } else {
+            Pending pending = {nId, server, port, request, fUseSSL, handler, 0};
+            h.queue.push_back(pending);
+            release(h, ready);
+            fQueued = ready.empty() || ready.back().nId != nId;
+            if (fQueued)
+                stats.nQueued++;
+        }
+    }
+
+    // The host has enough waiting for it already.
+    if (fRejected) {
+        if (request.GetCancel())
+            request.GetCancel()->Disconnect();
+
+        HTTPResponse response;
+        response.ec = boost::system::errc::make_error_code(boost::system::errc::resource_unavailable_try_again);
+        handler(response);
+        return;
+    }
+
+    for (std::size_t i = 0; i < ready.size(); i++)
+        send(ready[i]);
+}
+
+void HTTPConcurrencyLimiter::send(Pending &pending) {
+    inner.AsyncRequest(pending.server, pending.port, pending.request, pending.fUseSSL, boost::bind(&HTTPConcurrencyLimiter::handle_response, this, pending.server + ":" + pending.port, std::chrono::steady_clock::now(), pending.nInFlight, pending.handler, _1));
+}
+
+void HTTPConcurrencyLimiter::handle_response(const std::string &key, std::chrono::steady_clock::time_point start, std::size_t nInFlight, HTTPResponseHandler handler, const HTTPResponse &response) {
+    std::vector<Pending> ready;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        Host &h = hosts[key];
+        h.nInFlight--;
+        // Given up on by the caller, which says nothing about the host.
+        if (response.ec != boost::asio::error::operation_aborted) {
+            bool fOverload = response.ec || response.nStatus == 429 || response.nStatus == 503;
+            std::chrono::microseconds latency = response.nLatency;
+            if (latency.count() == 0)
+                latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+            record(h, latency, nInFlight, fOverload);
+        }
+        release(h, ready);
+    }
+
+    for (std::size_t i = 0; i < ready.size(); i++)
+        send(ready[i]);
+
+    handler(response);
+}
+
+void HTTPConcurrencyLimiter::cancel_pending(const std::string &key, uint64_t nId) {
+    HTTPResponseHandler handler;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        std::deque<Pending> &queue = hosts[key].queue;
+        for (std::deque<Pending>::iterator it = queue.begin(); it != queue.end(); ++it) {
+            if (it->nId == nId) {
+                handler = it->handler;
+                queue.erase(it);
+                break;
+            }
+        }
+    }
+
+    // Already sent, cancelling is down to whatever it was sent through.
+    if (!handler)
+        return;
+
+    HTTPResponse response;
+    response.ec = boost::asio::error::operation_aborted;
+    handler(response);
+}
+
+HTTPConcurrencyState HTTPConcurrencyLimiter::GetState(const std::string &server, const std::string &port) {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    Host &h = host(server, port);
+
+    HTTPConcurrencyState state;
+    state.dLimit = h.dLimit;
+    state.nInFlight = h.nInFlight;
+    state.nQueued = h.queue.size();
+    state.nBaseline = std::chrono::microseconds(h.nBaseline);
+    state.nLatency = std::chrono::microseconds((int64_t)h.dLatency);
+    return state;
+}
+
+#endif // _CONCURRENCY_HPP_
@@ -0,0 +1,391 @@
+#ifndef _CONNECTIONPOOL_HPP_
+#define _CONNECTIONPOOL_HPP_
+
+#include <sys/socket.h>
+
+#include <cerrno>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <set>
+#include <tuple>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <connector.hpp>
+#include <tlscontext.hpp>
+
+namespace {
+    typedef boost::asio::ssl::stream<boost::asio::ip::tcp::socket> SSLStream;
+} // namespace
+
+/** A single connection to a server (wrapped in TLS when fUseSSL is set) which
+ * can be handed back to an HTTPConnectionPool once a response has been fully
+ * read and reused for the next request to the same host. */
+class HTTPConnection {
+    public:
+        HTTPConnection(boost::asio::io_service &io_serviceIn, TLSContext &tlsIn, const std::string &serverIn, const std::string &portIn, bool fUseSSLIn) : io_service(io_serviceIn), tls(tlsIn), context(tlsIn.Get()), stream(io_serviceIn, *context), server(serverIn), port(portIn) {
+            fUseSSL = fUseSSLIn;
+            nRequests = 0;
+            lastUsed = std::chrono::steady_clock::now();
+            if (fUseSSL)
+                stream.set_verify_mode(boost::asio::ssl::verify_peer);
+        }
+
+        /** Check that an idle connection is still open and has not been closed
+         * (or written to) by the server while sitting in the pool. */
+        bool IsAlive();
+        /** Run the client side of the TLS handshake, resuming a cached session
+         * for the host when possible. */
+        void Handshake(boost::system::error_code &ec) {
+            BeginHandshake();
+            stream.handshake(boost::asio::ssl::stream_base::client, ec);
+            EndHandshake(ec);
+        }
+        /** Bracket an asynchronous handshake the same way Handshake does. */
+        void BeginHandshake() {
+            tls.PrepareSession(stream.native_handle(), server, port);
+        }
+        void EndHandshake(const boost::system::error_code &ec) {
+            tls.EndHandshake(stream.native_handle(), ec);
+        }
+        /** Connect to whichever of endpoints answers first (see
+         * HTTPConnector), closing the connection cancels the attempt. */
+        void AsyncConnect(const std::vector<boost::asio::ip::tcp::endpoint> &endpoints, HTTPConnectHandler handler) {
+            connector = boost::make_shared<HTTPConnector>(boost::ref(io_service), boost::ref(stream.next_layer()), server, port, endpoints, handler);
+            connector->Start();
+        }
+        /** Close the connection. OpenSSL throws away the session of a TLS
+         * connection which is freed without a shutdown, so after a clean close
+         * mark the session as shut down to keep it resumable. */
+        void Close(bool fClean) {
+            if (fClean && fUseSSL)
+                SSL_set_shutdown(stream.native_handle(), SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+
+            if (connector) {
+                connector->Cancel();
+                connector.reset();
+            }
+
+            boost::system::error_code ec;
+            stream.lowest_layer().close(ec);
+        }
+        /** Check if the underlying socket has been connected. */
+        bool IsOpen() {
+            return stream.lowest_layer().is_open();
+        }
+
+        boost::asio::io_service &io_service;
+        TLSContext &tls;
+        /** Context the stream was created with, kept alive across reloads. */
+        boost::shared_ptr<boost::asio::ssl::context> context;
+        SSLStream stream;
+        const std::string server;
+        const std::string port;
+        bool fUseSSL;
+        /** Number of requests completed on this connection. */
+        unsigned int nRequests;
+        std::chrono::steady_clock::time_point lastUsed;
+
+    private:
+        boost::shared_ptr<HTTPConnector> connector;
+};
+
+bool HTTPConnection::IsAlive() {
+    if (!IsOpen())
+        return false;
+
+    /* A non-blocking peek reports an orderly shutdown as 0 bytes; anything the
+     * server sent while we were idle means we can no longer trust framing. */
+    char c;
+    ssize_t n = ::recv(stream.lowest_layer().native_handle(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n >= 0)
+        return false;
+
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+struct HTTPPoolStats {
+    /** Requests served on an idle pooled connection. */
+    uint64_t nHits;
+    /** Requests which had to open a new connection. */
+    uint64_t nMisses;
+    /** Idle connections dropped because they expired or were closed. */
+    uint64_t nEvictions;
+    /** Connections currently sitting idle in the pool. */
+    uint64_t nIdle;
+};
+
+/** Called with a connection checked out by AsyncAcquire and whether it was
+ * reused from the pool. */
+typedef boost::function<void(boost::shared_ptr<HTTPConnection>, bool)> HTTPAcquireHandler;
+
+/** Keeps idle keep-alive connections keyed by (server, port, secure) so that
+ * repeated requests to the same host skip the TCP connect and TLS handshake.
+ * Connections are checked out with Acquire (or AsyncAcquire) and must be
+ * handed back with Release once the response has been read.
+ *
+ * A pool created with fThreadSafe cleared takes no locks at all; it must only
+ * ever be used from the one thread running its io_service. */
+class HTTPConnectionPool {
+    public:
+        HTTPConnectionPool(boost::asio::io_service &io_serviceIn, TLSContext &contextIn, unsigned int nMaxPerHostIn = 8, unsigned int nIdleTimeoutIn = 30, bool fThreadSafeIn = true) : io_service(io_serviceIn), context(contextIn) {
+            nMaxPerHost = nMaxPerHostIn > 0 ? nMaxPerHostIn : 1;
+            nIdleTimeout = std::chrono::seconds(nIdleTimeoutIn);
+            fThreadSafe = fThreadSafeIn;
+            fShutdown = false;
+            stats = HTTPPoolStats();
+        }
+
+        /** Take an idle connection to server:port from the pool, or create a new
+         * (unconnected) one when none is available. Blocks while nMaxPerHost
+         * connections to the host are already checked out (a single threaded
+         * pool can't wait and returns an empty pointer instead, as does a pool
+         * which has been shut down). */
+        boost::shared_ptr<HTTPConnection> Acquire(const std::string &/*server*/, const std::string &/*port*/, bool fUseSSL, bool &/*fReused*/);
+        /** Non-blocking Acquire for use from io_service handlers, the handler is
+         * posted to the pool's io_service once a connection is available (or
+         * with an empty pointer if the pool is shut down first). */
+        void AsyncAcquire(const std::string &/*server*/, const std::string &/*port*/, bool fUseSSL, HTTPAcquireHandler /*handler*/);
+        /** Hand a connection back to the pool, it is only kept for reuse if
+         * fReusable is set, otherwise it is closed. fClean should be cleared
+         * when giving up on a connection after an error. */
+        void Release(boost::shared_ptr<HTTPConnection> /*conn*/, bool fReusable, bool fClean = true);
+        /** Drop idle connections that have expired or been closed by the server. */
+        void Prune();
+        /** Close every connection, idle or checked out (aborting whatever is in
+         * flight on them) and refuse any further checkouts. */
+        void Shutdown();
+        /** Check if Shutdown has been called, a connection checked out before
+         * then mustn't be connected any more. */
+        bool IsShutdown() {
+            pool_lock guard(*this);
+            return fShutdown;
+        }
+        HTTPPoolStats GetStats();
+
+        /** The io_service every connection from this pool is bound to. */
+        boost::asio::io_service &GetIOService() {
+            return io_service;
+        }
+
+    private:
+        typedef std::tuple<std::string, std::string, bool> HostKey;
+
+        /* Holds the pool mutex, unless the pool is confined to one thread. */
+        struct pool_lock {
+            pool_lock(HTTPConnectionPool &pool) : lock(pool.mutex, boost::defer_lock) {
+                if (pool.fThreadSafe)
+                    lock.lock();
+            }
+
+            boost::unique_lock<boost::mutex> lock;
+        };
+
+        struct HostEntry {
+            HostEntry() : nOpen(0) {}
+
+            /** Idle connections, most recently used at the back. */
+            std::deque<boost::shared_ptr<HTTPConnection> > idle;
+            /** Connections to this host, both idle and checked out. */
+            unsigned int nOpen;
+            /** Connections currently checked out. */
+            std::set<boost::shared_ptr<HTTPConnection> > active;
+            /** AsyncAcquire callers waiting for a connection to be released. */
+            std::deque<HTTPAcquireHandler> waiters;
+        };
+
+        bool expired(const boost::shared_ptr<HTTPConnection> &conn, std::chrono::steady_clock::time_point now) {
+            return now - conn->lastUsed >= nIdleTimeout;
+        }
+
+        void evict(HostEntry &entry, boost::shared_ptr<HTTPConnection> conn) {
+            conn->Close(true);
+            entry.nOpen--;
+            stats.nEvictions++;
+            stats.nIdle--;
+        }
+
+        void prune_host(HostEntry &/*entry*/, std::chrono::steady_clock::time_point now);
+        /** Try to check out a connection without waiting, returns an empty
+         * pointer when the host is at its connection limit. */
+        boost::shared_ptr<HTTPConnection> try_acquire(HostEntry &/*entry*/, const HostKey &/*key*/, bool &/*fReused*/);
+
+        boost::asio::io_service &io_service;
+        TLSContext &context;
+        unsigned int nMaxPerHost;
+        std::chrono::steady_clock::duration nIdleTimeout;
+        bool fThreadSafe;
+        bool fShutdown;
+
+        boost::mutex mutex;
+        boost::condition_variable cond;
+        std::map<HostKey, HostEntry> hosts;
+        HTTPPoolStats stats;
+};
+
+/* Expired connections are always the oldest so they are found at the front of
+ * the idle list. */
+void HTTPConnectionPool::prune_host(HostEntry &entry, std::chrono::steady_clock::time_point now) {
+    while (!entry.idle.empty() && expired(entry.idle.front(), now)) {
+        evict(entry, entry.idle.front());
+        entry.idle.pop_front();
+    }
+}
+
+boost::shared_ptr<HTTPConnection> HTTPConnectionPool::try_acquire(HostEntry &entry, const HostKey &key, bool &fReused) {
+    if (fShutdown)
+        return boost::shared_ptr<HTTPConnection>();
+
+    prune_host(entry, std::chrono::steady_clock::now());
+
+    /* Prefer the most recently used connection, it is the least likely to have
+     * been timed out by the server. */
+    while (!entry.idle.empty()) {
+        boost::shared_ptr<HTTPConnection> conn = entry.idle.back();
+        entry.idle.pop_back();
+        if (!conn->IsAlive()) {
+            evict(entry, conn);
+            continue;
+        }
+
+        stats.nHits++;
+        stats.nIdle--;
+        fReused = true;
+        entry.active.insert(conn);
+        return conn;
+    }
+
+    if (entry.nOpen < nMaxPerHost) {
+        entry.nOpen++;
+        stats.nMisses++;
+        fReused = false;
+        boost::shared_ptr<HTTPConnection> conn = boost::make_shared<HTTPConnection>(io_service, context, std::get<0>(key), std::get<1>(key), std::get<2>(key));
+        entry.active.insert(conn);
+        return conn;
+    }
+
+    return boost::shared_ptr<HTTPConnection>();
+}
+
+boost::shared_ptr<HTTPConnection> HTTPConnectionPool::Acquire(const std::string &server, const std::string &port, bool fUseSSL, bool &fReused) {
+    pool_lock guard(*this);
+    HostKey key(server, port, fUseSSL);
+    HostEntry &entry = hosts[key];
+
+    while (true) {
+        boost::shared_ptr<HTTPConnection> conn = try_acquire(entry, key, fReused);
+        if (conn || fShutdown || !fThreadSafe)
+            return conn;
+
+        cond.wait(guard.lock);
+    }
+}
+
+void HTTPConnectionPool::AsyncAcquire(const std::string &server, const std::string &port, bool fUseSSL, HTTPAcquireHandler handler) {
+    pool_lock guard(*this);
+    HostKey key(server, port, fUseSSL);
+    HostEntry &entry = hosts[key];
+
+    bool fReused = false;
+    boost::shared_ptr<HTTPConnection> conn = try_acquire(entry, key, fReused);
+    if (conn || fShutdown)
+        io_service.post(boost::bind(handler, conn, fReused));
+    else
+        entry.waiters.push_back(handler);
+}
+
+/* Released connections go to asynchronous waiters first, in the order they
+ * asked, before any thread blocked in Acquire is woken. */
+void HTTPConnectionPool::Release(boost::shared_ptr<HTTPConnection> conn, bool fReusable, bool fClean) {
+    {
+        pool_lock guard(*this);
+        HostKey key(conn->server, conn->port, conn->fUseSSL);
+        HostEntry &entry = hosts[key];
+        entry.active.erase(conn);
+        if (fReusable && !fShutdown && conn->IsOpen()) {
+            conn->lastUsed = std::chrono::steady_clock::now();
+            entry.idle.push_back(conn);
+            stats.nIdle++;
+        } else {
+            conn->Close(fClean);
+            entry.nOpen--;
+        }
+
+        while (!entry.waiters.empty()) {
+            bool fReused = false;
+            boost::shared_ptr<HTTPConnection> next = try_acquire(entry, key, fReused);
+            if (!next)
+                break;
+
+            io_service.post(boost::bind(entry.waiters.front(), next, fReused));
+            entry.waiters.pop_front();
+        }
+    }
+
+    cond.notify_all();
+}
+
+void HTTPConnectionPool::Prune() {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    {
+        pool_lock guard(*this);
+        for (std::map<HostKey, HostEntry>::iterator it = hosts.begin(); it != hosts.end(); ++it) {
+            HostEntry &entry = it->second;
+            prune_host(entry, now);
+
+            std::deque<boost::shared_ptr<HTTPConnection> > alive;
+            for (std::size_t i = 0; i < entry.idle.size(); i++) {
+                if (entry.idle[i]->IsAlive())
+                    alive.push_back(entry.idle[i]);
+                else
+                    evict(entry, entry.idle[i]);
+            }
+            entry.idle.swap(alive);
+        }
+    }
+
+    cond.notify_all();
+}
+
+void HTTPConnectionPool::Shutdown() {
+    std::deque<HTTPAcquireHandler> waiters;
+    {
+        pool_lock guard(*this);
+        fShutdown = true;
+        for (std::map<HostKey, HostEntry>::iterator it = hosts.begin(); it != hosts.end(); ++it) {
+            HostEntry &entry = it->second;
+            while (!entry.idle.empty()) {
+                evict(entry, entry.idle.front());
+                entry.idle.pop_front();
+            }
+
+            /* Closing the socket cancels any pending operation on it, the
+             * requests holding these will fail and release them. */
+            for (std::set<boost::shared_ptr<HTTPConnection> >::iterator conn = entry.active.begin(); conn != entry.active.end(); ++conn)
+                (*conn)->Close(false);
+
+            waiters.insert(waiters.end(), entry.waiters.begin(), entry.waiters.end());
+            entry.waiters.clear();
+        }
+    }
+
+    for (std::size_t i = 0; i < waiters.size(); i++)
+        io_service.post(boost::bind(waiters[i], boost::shared_ptr<HTTPConnection>(), false));
+
+    cond.notify_all();
+}
+
+HTTPPoolStats HTTPConnectionPool::GetStats() {
+    pool_lock guard(*this);
+    return stats;
+}
+
+#endif // _CONNECTIONPOOL_HPP_
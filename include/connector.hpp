@@ -0,0 +1,252 @@
+#ifndef _CONNECTOR_HPP_
+#define _CONNECTOR_HPP_
+
+#include <chrono>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <deadline.hpp>
+#include <resolvercache.hpp>
+
+/** Called once an HTTPConnector has connected its target socket, or failed to. */
+typedef boost::function<void(const boost::system::error_code&)> HTTPConnectHandler;
+
+/** Connects to the first of a host's endpoints to answer, racing them the way
+ * RFC 8305 (Happy Eyeballs) describes rather than waiting out each one in
+ * turn:
+ *
+ *  - endpoints are tried alternating between address families, starting with
+ *    the family of the first one;
+ *  - each attempt gets ATTEMPT_DELAY to connect before the next one starts
+ *    alongside it, and one which fails sooner starts the next straight away;
+ *  - the first connection made wins, every other attempt is cancelled.
+ *
+ * So an address which is black-holed (an IPv6 route which goes nowhere is the
+ * usual one) only costs the delay instead of the OS connect timeout. The
+ * winner is remembered in the resolver cache, which puts it first the next
+ * time the host is looked up. */
+class HTTPConnector : public boost::enable_shared_from_this<HTTPConnector> {
+    public:
+        /** Attempts run on io_service and the winning connection is moved into
+         * target, which may belong to another io_service. */
+        HTTPConnector(boost::asio::io_service &io_serviceIn, boost::asio::ip::tcp::socket &targetIn, const std::string &serverIn, const std::string &portIn, const std::vector<boost::asio::ip::tcp::endpoint> &endpointsIn, HTTPConnectHandler handlerIn) : io_service(io_serviceIn), target(targetIn), server(serverIn), port(portIn), endpoints(interleave(endpointsIn)), handler(handlerIn), timer(io_serviceIn) {
+            nNext = 0;
+            nPending = 0;
+            nTimer = 0;
+            fDone = false;
+            fCancelled = false;
+        }
+
+        void Start() {
+            if (endpoints.empty()) {
+                finish(boost::asio::error::host_not_found);
+                return;
+            }
+
+            start_next();
+        }
+
+        /** Stop every attempt, the handler gets operation_aborted unless a
+         * connection has already been made. */
+        void Cancel();
+
+        /** Blocking connect, racing the attempts on a private io_service.
+         * Gives up with timed_out at deadline unless it is left at its
+         * default, or with operation_aborted if guard is aborted first. */
+        static bool Connect(boost::asio::ip::tcp::socket &/*target*/, const std::string &/*server*/, const std::string &/*port*/, const std::vector<boost::asio::ip::tcp::endpoint> &/*endpoints*/, boost::system::error_code &/*ec*/, std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point(), HTTPSocketGuard *guard = NULL);
+
+    private:
+        /* RFC 8305 recommends 250ms. */
+        enum { ATTEMPT_DELAY = 250 };
+
+        static std::vector<boost::asio::ip::tcp::endpoint> interleave(const std::vector<boost::asio::ip::tcp::endpoint> &/*in*/);
+
+        static void set_error(boost::system::error_code *out, const boost::system::error_code &ec) {
+            *out = ec;
+        }
+
+        /* Cancel from another thread. */
+        void post_cancel() {
+            io_service.post(boost::bind(&HTTPConnector::Cancel, shared_from_this()));
+        }
+
+        static void run(boost::asio::io_service &/*io_service*/, boost::shared_ptr<HTTPConnector> /*connector*/, boost::system::error_code &/*ec*/, std::chrono::steady_clock::time_point /*deadline*/);
+
+        void start_next();
+        void handle_timer(unsigned int /*nTimerIn*/, const boost::system::error_code &/*ec*/);
+        void handle_connect(std::size_t /*i*/, const boost::system::error_code &/*ec*/);
+        void finish(const boost::system::error_code &/*ec*/);
+
+        boost::asio::io_service &io_service;
+        boost::asio::ip::tcp::socket &target;
+        const std::string server;
+        const std::string port;
+        const std::vector<boost::asio::ip::tcp::endpoint> endpoints;
+        HTTPConnectHandler handler;
+        /** One socket per attempt started, in endpoint order. */
+        std::vector<boost::shared_ptr<boost::asio::ip::tcp::socket> > attempts;
+        boost::asio::steady_timer timer;
+        std::size_t nNext;
+        std::size_t nPending;
+        /** Bumped each time the timer is set, so a wait which completes after
+         * being replaced is ignored. */
+        unsigned int nTimer;
+        bool fDone;
+        bool fCancelled;
+        boost::system::error_code lastError;
+};
+
+std::vector<boost::asio::ip::tcp::endpoint> HTTPConnector::interleave(const std::vector<boost::asio::ip::tcp::endpoint> &in) {
+    std::vector<boost::asio::ip::tcp::endpoint> first, second, out;
+    for (std::size_t i = 0; i < in.size(); i++)
+        (in[i].protocol() == in[0].protocol() ? first : second).push_back(in[i]);
+
+    for (std::size_t i = 0; i < first.size() || i < second.size(); i++) {
+        if (i < first.size())
+            out.push_back(first[i]);
+        if (i < second.size())
+            out.push_back(second[i]);
+    }
+
+    return out;
+}
+
+void HTTPConnector::start_next() {
+    while (!fCancelled && nNext < endpoints.size()) {
+        std::size_t i = nNext++;
+        boost::shared_ptr<boost::asio::ip::tcp::socket> socket = boost::make_shared<boost::asio::ip::tcp::socket>(io_service);
+        attempts.push_back(socket);
+
+        // An address family the host can't use at all fails straight away.
+        boost::system::error_code ec;
+        socket->open(endpoints[i].protocol(), ec);
+        if (ec) {
+            lastError = ec;
+            continue;
+        }
+
+        nPending++;
+        socket->async_connect(endpoints[i], boost::bind(&HTTPConnector::handle_connect, shared_from_this(), i, boost::asio::placeholders::error));
+
+        if (nNext < endpoints.size()) {
+            timer.expires_after(std::chrono::milliseconds(ATTEMPT_DELAY));
+            timer.async_wait(boost::bind(&HTTPConnector::handle_timer, shared_from_this(), ++nTimer, boost::asio::placeholders::error));
+        }
+        return;
+    }
+
+    if (nPending == 0)
+        finish(lastError ? lastError : boost::asio::error::host_not_found);
+}
+
+void HTTPConnector::handle_timer(unsigned int nTimerIn, const boost::system::error_code &ec) {
+    if (fDone || ec || nTimerIn != nTimer)
+        return;
+
+    start_next();
+}
+
+void HTTPConnector::handle_connect(std::size_t i, const boost::system::error_code &ec) {
+    nPending--;
+    if (fDone)
+        return;
+
+    if (ec || fCancelled) {
+        if (!fCancelled)
+            lastError = ec;
+        boost::system::error_code ignored;
+        attempts[i]->close(ignored);
+
+        // Don't wait out the delay for an attempt which has already failed.
+        timer.cancel();
+        nTimer++;
+        start_next();
+        return;
+    }
+
+    fDone = true;
+    timer.cancel();
+    boost::system::error_code ignored;
+    for (std::size_t n = 0; n < attempts.size(); n++) {
+        if (n != i)
+            attempts[n]->close(ignored);
+    }
+
+    if (endpoints[i] != endpoints[0])
+        HTTPResolverCache::Global().Prefer(server, port, endpoints[i]);
+
+    boost::system::error_code error;
+    target.close(ignored);
+    target.assign(endpoints[i].protocol(), attempts[i]->release(error), error);
+    finish(error);
+}
+
+void HTTPConnector::Cancel() {
+    if (fDone || fCancelled)
+        return;
+
+    fCancelled = true;
+    lastError = boost::asio::error::operation_aborted;
+    timer.cancel();
+    boost::system::error_code ignored;
+    for (std::size_t n = 0; n < attempts.size(); n++)
+        attempts[n]->close(ignored);
+
+    // Not straight from here, the caller may be holding a lock the handler needs.
+    if (nPending == 0)
+        io_service.post(boost::bind(&HTTPConnector::finish, shared_from_this(), lastError));
+}
+
+void HTTPConnector::finish(const boost::system::error_code &ec) {
+    fDone = true;
+    HTTPConnectHandler done;
+    done.swap(handler);
+    done(ec);
+}
+
+bool HTTPConnector::Connect(boost::asio::ip::tcp::socket &target, const std::string &server, const std::string &port, const std::vector<boost::asio::ip::tcp::endpoint> &endpoints, boost::system::error_code &ec, std::chrono::steady_clock::time_point deadline, HTTPSocketGuard *guard) {
+    boost::asio::io_service io_service;
+    ec = boost::asio::error::would_block;
+    boost::shared_ptr<HTTPConnector> connector = boost::make_shared<HTTPConnector>(boost::ref(io_service), boost::ref(target), server, port, endpoints, boost::bind(&HTTPConnector::set_error, &ec, _1));
+    connector->Start();
+    if (guard) {
+        guard->SetInterrupt(boost::bind(&HTTPConnector::post_cancel, connector));
+        // Too late for the interrupt, don't wait for the connect to finish.
+        if (guard->Aborted())
+            connector->Cancel();
+    }
+
+    run(io_service, connector, ec, deadline);
+    // Nothing may be posted to the io_service once it has gone.
+    if (guard)
+        guard->SetInterrupt(HTTPSocketGuard::Interrupt());
+
+    return !ec;
+}
+
+void HTTPConnector::run(boost::asio::io_service &io_service, boost::shared_ptr<HTTPConnector> connector, boost::system::error_code &ec, std::chrono::steady_clock::time_point deadline) {
+    if (deadline == std::chrono::steady_clock::time_point()) {
+        io_service.run();
+        return;
+    }
+
+    io_service.run_until(deadline);
+    if (ec != boost::asio::error::would_block)
+        return;
+
+    // Out of time, call off whatever is still trying and wait for it to stop.
+    connector->Cancel();
+    io_service.restart();
+    io_service.run();
+    if (ec == boost::asio::error::operation_aborted)
+        ec = boost::asio::error::timed_out;
+}
+
+#endif // _CONNECTOR_HPP_
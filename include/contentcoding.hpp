@@ -0,0 +1,401 @@
+#ifndef _CONTENTCODING_HPP_
+#define _CONTENTCODING_HPP_
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <string>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <zlib.h>
+#ifdef HAVE_BROTLI
+    #include <brotli/decode.h>
+#endif
+#ifdef HAVE_ZSTD
+    #include <zstd.h>
+#endif
+
+struct HTTPContentStats {
+    /** Encoded responses decoded. */
+    uint64_t nResponses;
+    /** Bytes received before and after decoding, their ratio is the
+     * compression ratio. */
+    uint64_t nEncodedBytes;
+    uint64_t nDecodedBytes;
+    /** Thread CPU time spent decoding, in microseconds. */
+    uint64_t nCPUMicros;
+};
+
+/** Streaming decoder for a response's Content-Encoding. Compressed bytes are
+ * fed in as they arrive and the output is written straight onto the end of
+ * the caller's string, so no compressed or decompressed copy of the whole body
+ * is ever held apart from the result.
+ *
+ * gzip and deflate are always available; br and zstd when built against
+ * brotli and zstd (HAVE_BROTLI, HAVE_ZSTD). */
+class HTTPContentDecoder {
+    public:
+        HTTPContentDecoder() : coding(IDENTITY), fStarted(false), fEnded(false) {
+#ifdef HAVE_BROTLI
+            brotli = NULL;
+#endif
+#ifdef HAVE_ZSTD
+            zstd = NULL;
+#endif
+            nEncoded = 0;
+            nDecoded = 0;
+            nCPUMicros = 0;
+        }
+
+        ~HTTPContentDecoder() {
+            reset();
+        }
+
+        /** The Accept-Encoding value listing every coding this build can
+         * decode, for use in requests. */
+        static const char *AcceptEncoding() {
+            return "gzip, deflate"
+#ifdef HAVE_BROTLI
+                ", br"
+#endif
+#ifdef HAVE_ZSTD
+                ", zstd"
+#endif
+                ;
+        }
+
+        /** Get ready for a body sent with the given Content-Encoding. Returns
+         * false if it isn't one we can decode. */
+        bool Init(const std::string &/*strEncoding*/);
+
+        /** Check if there is anything to decode at all. */
+        bool IsActive() const {
+            return coding != IDENTITY;
+        }
+
+        /** Decode the next size bytes of the body, appending the output to
+         * out. Returns false if the data is corrupt. */
+        bool Decode(const char */*data*/, std::size_t /*size*/, std::string &/*out*/);
+
+        /** Call once the whole body has been fed in, returns false if it
+         * stopped short of the end of the compressed stream. */
+        bool Finish();
+
+        /** Decoding totals for the whole process. */
+        static HTTPContentStats GetStats() {
+            boost::lock_guard<boost::mutex> lock(stats_mutex());
+            return stats();
+        }
+
+    private:
+        enum Coding {
+            IDENTITY,
+            GZIP,
+            DEFLATE,
+            BROTLI,
+            ZSTD
+        };
+
+        /* Output is decoded into the string in steps of at least this much. */
+        enum { CHUNK_SIZE = 16 * 1024 };
+
+        static boost::mutex &stats_mutex() {
+            static boost::mutex mutex;
+            return mutex;
+        }
+
+        static HTTPContentStats &stats() {
+            static HTTPContentStats totals = HTTPContentStats();
+            return totals;
+        }
+
+        static uint64_t cpu_micros() {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+            struct timespec ts;
+            if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+                return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+            return 0;
+        }
+
+        /* Make room for at least nMin more bytes of output at the end of out,
+         * returning where it starts. */
+        static char *grow(std::string &out, std::size_t nUsed, std::size_t nMin) {
+            std::size_t nSize = nUsed + std::max<std::size_t>(nMin, CHUNK_SIZE);
+            if (out.capacity() < nSize)
+                out.reserve(std::max(nSize, out.capacity() * 2));
+            out.resize(nSize);
+
+            return &out[nUsed];
+        }
+
+        bool init_zlib(int nWindowBits) {
+            memset(&zs, 0, sizeof(zs));
+            return inflateInit2(&zs, nWindowBits) == Z_OK;
+        }
+
+        bool inflate_data(const char */*data*/, std::size_t /*size*/, std::string &/*out*/);
+#ifdef HAVE_BROTLI
+        bool brotli_data(const char */*data*/, std::size_t /*size*/, std::string &/*out*/);
+#endif
+#ifdef HAVE_ZSTD
+        bool zstd_data(const char */*data*/, std::size_t /*size*/, std::string &/*out*/);
+#endif
+        void reset();
+
+        Coding coding;
+        /** Set once the zlib header of a deflate body has been accepted,
+         * until then it may still turn out to be raw deflate. */
+        bool fStarted;
+        /** What inflate took of a deflate body before fStarted, to be fed
+         * again if it does turn out to be raw. */
+        std::string strHeader;
+        /** Set once the end of the compressed stream has been seen. */
+        bool fEnded;
+        z_stream zs;
+#ifdef HAVE_BROTLI
+        BrotliDecoderState *brotli;
+#endif
+#ifdef HAVE_ZSTD
+        ZSTD_DStream *zstd;
+#endif
+        uint64_t nEncoded;
+        uint64_t nDecoded;
+        uint64_t nCPUMicros;
+};
+
+bool HTTPContentDecoder::Init(const std::string &strEncoding) {
+    reset();
+
+    std::string encoding = boost::algorithm::to_lower_copy(boost::algorithm::trim_copy(strEncoding));
+    if (encoding.empty() || encoding == "identity")
+        return true;
+
+    if (encoding == "gzip" || encoding == "x-gzip") {
+        coding = GZIP;
+        return init_zlib(15 + 16);
+    }
+
+    if (encoding == "deflate") {
+        coding = DEFLATE;
+        return init_zlib(15);
+    }
+
+#ifdef HAVE_BROTLI
+    if (encoding == "br") {
+        coding = BROTLI;
+        brotli = BrotliDecoderCreateInstance(NULL, NULL, NULL);
+        return brotli != NULL;
+    }
+#endif
+
+#ifdef HAVE_ZSTD
+    if (encoding == "zstd") {
+        coding = ZSTD;
+        zstd = ZSTD_createDStream();
+        return zstd != NULL && !ZSTD_isError(ZSTD_initDStream(zstd));
+    }
+#endif
+
+    printf("HTTPContentDecoder::Init : unsupported content encoding %s\n", strEncoding.c_str());
+    return false;
+}
+
+bool HTTPContentDecoder::Decode(const char *data, std::size_t size, std::string &out) {
+    if (coding == IDENTITY) {
+        out.append(data, size);
+        return true;
+    }
+
+    // Nothing to do, and zstd would take it as the start of another frame.
+    if (size == 0)
+        return true;
+
+    uint64_t nStart = cpu_micros();
+    std::size_t nBefore = out.size();
+    bool fOk;
+    switch (coding) {
+        case GZIP:
+        case DEFLATE:
+            fOk = inflate_data(data, size, out);
+            break;
+#ifdef HAVE_BROTLI
+        case BROTLI:
+            fOk = brotli_data(data, size, out);
+            break;
+#endif
+#ifdef HAVE_ZSTD
+        case ZSTD:
+            fOk = zstd_data(data, size, out);
+            break;
+#endif
+        default:
+            fOk = false;
+    }
+
+    nEncoded += size;
+    nDecoded += out.size() - nBefore;
+    nCPUMicros += cpu_micros() - nStart;
+    return fOk;
+}
+
+bool HTTPContentDecoder::Finish() {
+    if (coding == IDENTITY)
+        return true;
+
+    {
+        boost::lock_guard<boost::mutex> lock(stats_mutex());
+        HTTPContentStats &totals = stats();
+        totals.nResponses++;
+        totals.nEncodedBytes += nEncoded;
+        totals.nDecodedBytes += nDecoded;
+        totals.nCPUMicros += nCPUMicros;
+    }
+
+    // An empty body is fine, one cut off part way through the stream isn't.
+    bool fComplete = fEnded || nEncoded == 0;
+    reset();
+    return fComplete;
+}
+
+bool HTTPContentDecoder::inflate_data(const char *data, std::size_t size, std::string &out) {
+    std::string replay;
+    zs.next_in = (Bytef*)data;
+    zs.avail_in = size;
+    std::size_t nUsed = out.size();
+    while (zs.avail_in != 0) {
+        /* Anything after the end of a gzip member is either another member or
+         * junk; inflate handles the first and the junk is an error. */
+        if (fEnded) {
+            if (coding != GZIP || inflateReset(&zs) != Z_OK)
+                break;
+            fEnded = false;
+        }
+
+        zs.next_out = (Bytef*)grow(out, nUsed, zs.avail_in * 2);
+        zs.avail_out = out.size() - nUsed;
+        const Bytef *in = zs.next_in;
+        int ret = inflate(&zs, Z_NO_FLUSH);
+
+        /* "deflate" is meant to be zlib wrapped but plenty of servers send a
+         * raw deflate stream, start over as that if the header is wrong. The
+         * header can arrive split over several pieces, so whatever of it came
+         * in earlier ones is fed again too. */
+        if (ret == Z_DATA_ERROR && coding == DEFLATE && !fStarted) {
+            inflateEnd(&zs);
+            if (!init_zlib(-15))
+                break;
+
+            fStarted = true;
+            replay.swap(strHeader);
+            replay.append(data, size);
+            zs.next_in = (Bytef*)replay.data();
+            zs.avail_in = replay.size();
+            continue;
+        }
+
+        nUsed = out.size() - zs.avail_out;
+        if (ret == Z_STREAM_END) {
+            fEnded = true;
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            out.resize(nUsed);
+            printf("HTTPContentDecoder::inflate_data : %s\n", zs.msg ? zs.msg : "corrupt data");
+            return false;
+        }
+
+        if (!fStarted) {
+            if (zs.total_in >= 2) {
+                fStarted = true;
+                strHeader.clear();
+            } else {
+                strHeader.append((const char*)in, zs.next_in - in);
+            }
+        }
+    }
+
+    out.resize(nUsed);
+    return zs.avail_in == 0;
+}
+
+#ifdef HAVE_BROTLI
+bool HTTPContentDecoder::brotli_data(const char *data, std::size_t size, std::string &out) {
+    const uint8_t *next_in = (const uint8_t*)data;
+    std::size_t avail_in = size;
+    std::size_t nUsed = out.size();
+    while (true) {
+        uint8_t *next_out = (uint8_t*)grow(out, nUsed, avail_in * 4);
+        std::size_t avail_out = out.size() - nUsed;
+        BrotliDecoderResult ret = BrotliDecoderDecompressStream(brotli, &avail_in, &next_in, &avail_out, &next_out, NULL);
+        nUsed = out.size() - avail_out;
+
+        if (ret == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT)
+            continue;
+
+        out.resize(nUsed);
+        if (ret == BROTLI_DECODER_RESULT_SUCCESS) {
+            fEnded = true;
+            return avail_in == 0;
+        }
+        if (ret == BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT)
+            return true;
+
+        printf("HTTPContentDecoder::brotli_data : %s\n", BrotliDecoderErrorString(BrotliDecoderGetErrorCode(brotli)));
+        return false;
+    }
+}
+#endif
+
+#ifdef HAVE_ZSTD
+bool HTTPContentDecoder::zstd_data(const char *data, std::size_t size, std::string &out) {
+    ZSTD_inBuffer in = { data, size, 0 };
+    std::size_t nUsed = out.size();
+    while (true) {
+        ZSTD_outBuffer output = { grow(out, nUsed, (in.size - in.pos) * 4), out.size() - nUsed, 0 };
+        std::size_t ret = ZSTD_decompressStream(zstd, &output, &in);
+        nUsed += output.pos;
+        if (ZSTD_isError(ret)) {
+            out.resize(nUsed);
+            printf("HTTPContentDecoder::zstd_data : %s\n", ZSTD_getErrorName(ret));
+            return false;
+        }
+
+        // 0 means a frame has just been completed and flushed.
+        fEnded = ret == 0;
+        if (in.pos == in.size && output.pos < output.size)
+            break;
+    }
+
+    out.resize(nUsed);
+    return true;
+}
+#endif
+
+void HTTPContentDecoder::reset() {
+    if (coding == GZIP || coding == DEFLATE)
+        inflateEnd(&zs);
+#ifdef HAVE_BROTLI
+    if (brotli)
+        BrotliDecoderDestroyInstance(brotli);
+    brotli = NULL;
+#endif
+#ifdef HAVE_ZSTD
+    if (zstd)
+        ZSTD_freeDStream(zstd);
+    zstd = NULL;
+#endif
+
+    coding = IDENTITY;
+    fStarted = false;
+    strHeader.clear();
+    fEnded = false;
+    nEncoded = 0;
+    nDecoded = 0;
+    nCPUMicros = 0;
+}
+
+#endif // _CONTENTCODING_HPP_
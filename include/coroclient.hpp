@@ -0,0 +1,91 @@
+#ifndef _COROCLIENT_HPP_
+#define _COROCLIENT_HPP_
+
+#include <memory>
+#include <utility>
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include <asyncclient.hpp>
+
+#ifndef BOOST_ASIO_HAS_CO_AWAIT
+    #error "coroclient.hpp needs C++20 coroutines, configure with -DENABLE_COROUTINES=ON"
+#endif
+
+/** Start an asynchronous request with any asio completion token, so passing
+ * boost::asio::use_awaitable lets a coroutine co_await the response. */
+template <typename CompletionToken>
+auto async_http_request(HTTPRequester &client, const std::string &server, const std::string &port, const HTTPRequest &request, bool fUseSSL, CompletionToken &&token) {
+    return boost::asio::async_initiate<CompletionToken, void(HTTPResponse)>(
+        [&client, server, port, request, fUseSSL](auto handler) {
+            /* Completion handlers for coroutines are move only while
+             * HTTPResponseHandler has to be copyable, so share it. */
+            typedef typename std::decay<decltype(handler)>::type Handler;
+            std::shared_ptr<Handler> shared = std::make_shared<Handler>(std::move(handler));
+            // Keep the waiting side's executor busy until we hand the response over.
+            typedef typename boost::asio::associated_executor<Handler>::type Executor;
+            std::shared_ptr<boost::asio::executor_work_guard<Executor> > work = std::make_shared<boost::asio::executor_work_guard<Executor> >(boost::asio::get_associated_executor(*shared));
+            client.AsyncRequest(server, port, request, fUseSSL, [shared, work](const HTTPResponse &response) {
+                boost::asio::dispatch(work->get_executor(), [shared, work, response]() mutable {
+                    (*shared)(response);
+                    work->reset();
+                });
+            });
+        }, token);
+}
+
+/** co_await-able versions of HandleRequest, ReadToString and ReadToJSON over
+ * any HTTPRequester. Chains of requests can be written as straight line code
+ * inside a coroutine (started with boost::asio::co_spawn) without blocking a
+ * thread or needing a stack per request:
+ *
+ *     HTTPResponse user = co_await client.HandleRequest(server, port, req, true);
+ *     bool fOk = co_await client.ReadToJSON(server, port, next, true, obj);
+ */
+class AwaitableHTTPClient {
+    public:
+        AwaitableHTTPClient(HTTPRequester &clientIn) : client(clientIn) {}
+
+        /** Send a request and resume with the complete response. */
+        boost::asio::awaitable<HTTPResponse> HandleRequest(const std::string server, const std::string port, const HTTPRequest request, bool fUseSSL) {
+            HTTPResponse response = co_await async_http_request(client, server, port, request, fUseSSL, boost::asio::use_awaitable);
+            co_return response;
+        }
+
+        /** Send a request and read the body of a successful response into a
+         * string. */
+        boost::asio::awaitable<bool> ReadToString(const std::string server, const std::string port, const HTTPRequest request, bool fUseSSL, std::string &strBuffer, bool printheaders = false) {
+            HTTPResponse response = co_await HandleRequest(server, port, request, fUseSSL);
+            if (!check_response("AwaitableHTTPClient::ReadToString", server, port, response, printheaders))
+                co_return false;
+
+            strBuffer.swap(response.body);
+            co_return true;
+        }
+
+        /** Send a request and parse the body of a successful response as a
+         * JSON object. */
+        boost::asio::awaitable<bool> ReadToJSON(const std::string server, const std::string port, const HTTPRequest request, bool fUseSSL, json_spirit::Object &obj, bool printheaders = false) {
+            HTTPRequest parsed(request);
+            parsed.SetParseJSON(true);
+            HTTPResponse response = co_await HandleRequest(server, port, parsed, fUseSSL);
+            if (!check_response("AwaitableHTTPClient::ReadToJSON", server, port, response, printheaders))
+                co_return false;
+
+            if (!response.ParseJSON() || response.json->type() != json_spirit::obj_type) {
+                printf("AwaitableHTTPClient::ReadToJSON : response is not a JSON object\n");
+                co_return false;
+            }
+
+            obj = response.json->get_obj();
+            co_return true;
+        }
+
+    private:
+        HTTPRequester &client;
+};
+
+#endif // _COROCLIENT_HPP_
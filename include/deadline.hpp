@@ -0,0 +1,262 @@
+#ifndef _DEADLINE_HPP_
+#define _DEADLINE_HPP_
+
+#include <sys/socket.h>
+
+#include <chrono>
+#include <string>
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+/** How long each phase of a request may take, in milliseconds, 0 for no
+ * limit. The phases run one after the other except total, which covers the
+ * whole request including waiting for a pooled connection and reading the
+ * body. */
+struct HTTPTimeouts {
+    HTTPTimeouts() : nResolve(0), nConnect(0), nHandshake(0), nFirstByte(0), nTotal(0) {}
+
+    /** DNS lookup, only when the answer isn't already cached. */
+    unsigned int nResolve;
+    /** TCP connect, across every address tried. */
+    unsigned int nConnect;
+    /** TLS handshake. */
+    unsigned int nHandshake;
+    /** From sending the request to having the whole response head. */
+    unsigned int nFirstByte;
+    unsigned int nTotal;
+    /** A point in time the whole request has to be done by, on top of
+     * nTotal. Left at its default there is none. */
+    std::chrono::steady_clock::time_point deadline;
+
+    /** When a request starting at start has to be finished by, the default
+     * time_point when it has no limit. */
+    std::chrono::steady_clock::time_point End(std::chrono::steady_clock::time_point start) const {
+        std::chrono::steady_clock::time_point end = deadline;
+        if (nTotal) {
+            std::chrono::steady_clock::time_point total = start + std::chrono::milliseconds(nTotal);
+            if (end == std::chrono::steady_clock::time_point() || total < end)
+                end = total;
+        }
+
+        return end;
+    }
+};
+
+/** The phase a request ran out of time in, as the value of an error code in
+ * http_timeout_category(). */
+enum HTTPTimeoutError {
+    HTTP_TIMEOUT_NONE = 0,
+    HTTP_TIMEOUT_RESOLVE,
+    HTTP_TIMEOUT_CONNECT,
+    HTTP_TIMEOUT_HANDSHAKE,
+    HTTP_TIMEOUT_FIRST_BYTE,
+    HTTP_TIMEOUT_TOTAL
+};
+
+class HTTPTimeoutCategory : public boost::system::error_category {
+    public:
+        const char *name() const BOOST_NOEXCEPT {
+            return "http.timeout";
+        }
+
+        std::string message(int ev) const {
+            switch (ev) {
+                case HTTP_TIMEOUT_RESOLVE:
+                    return "timed out resolving the host";
+                case HTTP_TIMEOUT_CONNECT:
+                    return "timed out connecting";
+                case HTTP_TIMEOUT_HANDSHAKE:
+                    return "timed out in the TLS handshake";
+                case HTTP_TIMEOUT_FIRST_BYTE:
+                    return "timed out waiting for the response";
+                case HTTP_TIMEOUT_TOTAL:
+                    return "request deadline exceeded";
+                default:
+                    return "no timeout";
+            }
+        }
+};
+
+namespace {
+    inline const boost::system::error_category &http_timeout_category() {
+        static HTTPTimeoutCategory category;
+        return category;
+    }
+
+    inline boost::system::error_code make_timeout_error(HTTPTimeoutError phase) {
+        return boost::system::error_code(phase, http_timeout_category());
+    }
+
+    /** Check if a request failed because one of its deadlines passed. */
+    inline bool is_timeout(const boost::system::error_code &ec) {
+        return ec && ec.category() == http_timeout_category();
+    }
+} // namespace
+
+/** Something to be done at a point in time unless it is called off first,
+ * created with HTTPWatchdog::Arm. */
+class HTTPAlarm : public boost::enable_shared_from_this<HTTPAlarm> {
+    public:
+        HTTPAlarm(boost::asio::io_service &io_service, boost::function<void()> actionIn) : timer(io_service), action(actionIn), fArmed(true) {}
+
+        /** Call the alarm off. Once this returns the action is either done or
+         * will never run. */
+        void Disarm() {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            if (!fArmed)
+                return;
+
+            fArmed = false;
+            action.clear();
+            // Don't leave the timer waiting until it would have gone off.
+            boost::asio::post(timer.get_executor(), boost::bind(&HTTPAlarm::cancel, shared_from_this()));
+        }
+
+    private:
+        friend class HTTPWatchdog;
+
+        void cancel() {
+            timer.cancel();
+        }
+
+        void handle_timer(const boost::system::error_code &ec) {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            if (ec || !fArmed)
+                return;
+
+            fArmed = false;
+            action();
+        }
+
+        boost::asio::steady_timer timer;
+        boost::mutex mutex;
+        boost::function<void()> action;
+        bool fArmed;
+};
+
+/** Runs alarms on a thread of its own, for code which has no io_service to
+ * put a timer on: blocking calls, where the action typically shuts down a
+ * socket some other thread is blocked on, and layers over any HTTPRequester
+ * like request hedging. Actions should be quick, they all share the one
+ * thread. */
+class HTTPWatchdog {
+    public:
+        HTTPWatchdog() {}
+
+        ~HTTPWatchdog() {
+            if (!thread)
+                return;
+
+            work.reset();
+            io_service.stop();
+            thread->join();
+        }
+
+        static HTTPWatchdog &Global() {
+            static HTTPWatchdog watchdog;
+            return watchdog;
+        }
+
+        /** Run action at when unless the returned alarm is disarmed first. */
+        boost::shared_ptr<HTTPAlarm> Arm(std::chrono::steady_clock::time_point when, boost::function<void()> action) {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            if (!thread) {
+                work.reset(new boost::asio::io_service::work(io_service));
+                thread.reset(new boost::thread(boost::bind(&boost::asio::io_service::run, &io_service)));
+            }
+
+            boost::shared_ptr<HTTPAlarm> alarm = boost::make_shared<HTTPAlarm>(boost::ref(io_service), action);
+            // The timer belongs to our thread, so it is only ever touched there.
+            io_service.post(boost::bind(&HTTPWatchdog::start, alarm, when));
+            return alarm;
+        }
+
+    private:
+        static void start(boost::shared_ptr<HTTPAlarm> alarm, std::chrono::steady_clock::time_point when) {
+            alarm->timer.expires_at(when);
+            alarm->timer.async_wait(boost::bind(&HTTPAlarm::handle_timer, alarm, boost::asio::placeholders::error));
+        }
+
+        boost::mutex mutex;
+        boost::asio::io_service io_service;
+        boost::scoped_ptr<boost::asio::io_service::work> work;
+        boost::scoped_ptr<boost::thread> thread;
+};
+
+/** Lets a watchdog alarm (or a cancel from another thread) interrupt a
+ * request blocked on a socket: Abort notes why and shuts the socket down, so
+ * the blocked call fails straight away. Shared with the alarms rather than
+ * owned by the request, so an alarm can never outlive what it touches. */
+class HTTPSocketGuard {
+    public:
+        typedef boost::function<void()> Interrupt;
+
+        HTTPSocketGuard() : fInterrupted(false) {}
+
+        /** The socket to shut down from now on, -1 for none. */
+        void SetSocket(int nSocket) {
+            SetInterrupt(nSocket >= 0 ? Interrupt(boost::bind(&HTTPSocketGuard::shutdown_socket, nSocket)) : Interrupt());
+        }
+
+        /** Something other than a socket to stop, e.g. a connect in
+         * progress. */
+        void SetInterrupt(Interrupt interruptIn) {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            interrupt = interruptIn;
+        }
+
+        void Reset() {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            aborted = boost::system::error_code();
+            fInterrupted = false;
+        }
+
+        void Abort(const boost::system::error_code &reason) {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            if (!aborted)
+                aborted = reason;
+            if (interrupt) {
+                interrupt();
+                fInterrupted = true;
+            }
+        }
+
+        void Expire(HTTPTimeoutError phase) {
+            Abort(make_timeout_error(phase));
+        }
+
+        /** Why the request was given up on since Reset, if it has been. */
+        boost::system::error_code Aborted() {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            return aborted;
+        }
+
+        /** Check if an abort got as far as interrupting anything, a
+         * connection it did is no use afterwards. */
+        bool Interrupted() {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            return fInterrupted;
+        }
+
+    private:
+        static void shutdown_socket(int nSocket) {
+            ::shutdown(nSocket, SHUT_RDWR);
+        }
+
+        boost::mutex mutex;
+        Interrupt interrupt;
+        boost::system::error_code aborted;
+        bool fInterrupted;
+};
+
+#endif // _DEADLINE_HPP_
@@ -0,0 +1,405 @@
+#ifndef _DISKCACHE_HPP_
+#define _DISKCACHE_HPP_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+
+#include <boost/crc.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/mutex.hpp>
+
+struct HTTPDiskCacheStats {
+    uint64_t nLookups;
+    uint64_t nHits;
+    uint64_t nStored;
+    /** Records which were found but failed their checks, i.e. were being
+     * overwritten or were torn by a crash. */
+    uint64_t nCorrupt;
+};
+
+/** Key to blob store in a memory-mapped file, which any number of processes
+ * can have open at once and which survives them restarting or crashing.
+ *
+ * The file is an index followed by a ring of records. Records are appended at
+ * a cursor which wraps round, overwriting the oldest, so the file never grows
+ * and nothing needs freeing. The index is a hash table of INDEX_WAYS slots per
+ * bucket, each pointing at the latest record for a key.
+ *
+ * Readers take no lock: they copy a record out and then check the cursor
+ * hasn't passed over it meanwhile, the key matches and its checksum holds.
+ * Writers are serialized by a lock on the file, which the system drops if the
+ * process holding it dies. A record is written in full before the index
+ * points at it, so a crash half way through a write at worst leaves a record
+ * behind which fails its checks and reads as a miss. Nothing needs replaying
+ * or repairing on open. */
+class HTTPDiskCache {
+    public:
+        HTTPDiskCache() : fd(-1), map(NULL), nMapSize(0), stats(HTTPDiskCacheStats()) {}
+
+        ~HTTPDiskCache() {
+            Close();
+        }
+
+        /** Map path, creating it nSize bytes long if it doesn't exist. An
+         * existing cache keeps its size, and one from another version or
+         * left half set up is set up again; any other file is left alone
+         * and fails. */
+        bool Open(const std::string &/*path*/, std::size_t nSize = 256 << 20);
+        void Close();
+
+        bool IsOpen() const {
+            return map != NULL;
+        }
+
+        /** Copy the value last stored for key into value. */
+        bool Get(const std::string &/*key*/, std::string &/*value*/);
+        /** Store value for key, replacing what was there. Values over a
+         * quarter of the ring aren't stored. */
+        bool Put(const std::string &/*key*/, const std::string &/*value*/);
+        void Erase(const std::string &/*key*/);
+
+        /** Counters for this process only. */
+        HTTPDiskCacheStats GetStats() {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            return stats;
+        }
+
+    private:
+        enum { MAGIC = 0x48444331, VERSION = 1, INDEX_WAYS = 4, RECORD_MAGIC = 0x52454331 };
+
+        /* All of this lives in the file, shared between processes. The
+         * atomics are lock-free and so don't depend on the process. */
+        struct Header {
+            uint32_t nMagic;
+            uint32_t nVersion;
+            uint64_t nBuckets;
+            uint64_t nRingSize;
+            /** Where the next record goes, as a count of every byte ever
+             * written to the ring, so it also tells what has been
+             * overwritten. */
+            std::atomic<uint64_t> nCursor;
+        };
+
+        struct Slot {
+            std::atomic<uint64_t> nHash;
+            /** Ring position the record was written at, as nCursor was. */
+            std::atomic<uint64_t> nPos;
+        };
+
+        struct Record {
+            uint32_t nMagic;
+            uint32_t nCRC;
+            uint64_t nHash;
+            uint32_t nKeySize;
+            uint32_t nValueSize;
+        };
+
+        /* FNV-1a, it needs to agree between builds as well as processes. */
+        static uint64_t hash(const std::string &key) {
+            uint64_t h = 0xcbf29ce484222325ULL;
+            for (std::size_t i = 0; i < key.size(); i++)
+                h = (h ^ (unsigned char)key[i]) * 0x100000001b3ULL;
+
+            // 0 marks an empty slot.
+            return h ? h : 1;
+        }
+
+        static uint32_t checksum(const char *data, std::size_t nSize) {
+            boost::crc_32_type crc;
+            crc.process_bytes(data, nSize);
+            return crc.checksum();
+        }
+
+        Header *header() const {
+            return (Header*)map;
+        }
+
+        Slot *bucket(uint64_t h) const {
+            return (Slot*)(map + sizeof(Header)) + (h % header()->nBuckets) * INDEX_WAYS;
+        }
+
+        char *ring() const {
+            return map + sizeof(Header) + header()->nBuckets * INDEX_WAYS * sizeof(Slot);
+        }
+
+        /* Check if the record at nPos is still all there with the cursor at
+         * nCursor. */
+        bool live(uint64_t nPos, uint64_t nSize, uint64_t nCursor) const {
+            return nPos + nSize <= nCursor && nCursor - nPos <= header()->nRingSize;
+        }
+
+        bool read(const Slot &/*slot*/, uint64_t h, const std::string &/*key*/, std::string &/*value*/);
+
+        /* Take or drop the lock on the file which writers hold. */
+        bool lock_file(short nType);
+
+        static std::size_t align(std::size_t n) {
+            return (n + 7) & ~(std::size_t)7;
+        }
+
+        /** Serializes writers within the process, the file lock only keeps
+         * other processes out. */
+        boost::mutex writeMutex;
+        int fd;
+        char *map;
+        std::size_t nMapSize;
+
+        boost::mutex mutex;
+        HTTPDiskCacheStats stats;
+};
+
+bool HTTPDiskCache::lock_file(short nType) {
+    struct flock fl;
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = nType;
+    fl.l_whence = SEEK_SET;
+    while (fcntl(fd, F_SETLKW, &fl) != 0) {
+        if (errno != EINTR) {
+            printf("HTTPDiskCache::lock_file : %s\n", strerror(errno));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool HTTPDiskCache::Open(const std::string &path, std::size_t nSize) {
+    Close();
+    boost::lock_guard<boost::mutex> lock(writeMutex);
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        printf("HTTPDiskCache::Open : can't open %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // Only one process at a time gets to set a new file up.
+    if (!lock_file(F_WRLCK)) {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+
+    struct stat st;
+    Header existing;
+    bool fValid = fstat(fd, &st) == 0 && (std::size_t)st.st_size >= sizeof(Header) && pread(fd, &existing, sizeof(existing), 0) == sizeof(existing)
+        && existing.nMagic == MAGIC && existing.nVersion == VERSION && existing.nBuckets > 0
+        && sizeof(Header) + existing.nBuckets * INDEX_WAYS * sizeof(Slot) + existing.nRingSize == (uint64_t)st.st_size;
+
+    // Never wipe a file which isn't ours, the path may well be a mistake.
+    bool fOurs = fstat(fd, &st) == 0 && (st.st_size == 0 || (pread(fd, &existing.nMagic, sizeof(existing.nMagic), 0) == sizeof(existing.nMagic) && existing.nMagic == MAGIC));
+    if (!fValid && !fOurs) {
+        printf("HTTPDiskCache::Open : %s is not a cache file\n", path.c_str());
+        lock_file(F_UNLCK);
+        close(fd);
+        fd = -1;
+        return false;
+    }
+
+    if (fValid) {
+        nMapSize = st.st_size;
+    } else {
+        // One bucket per 32KB of ring, i.e. a slot per 8KB.
+        uint64_t nBuckets = std::max<uint64_t>(nSize >> 15, 16);
+        uint64_t nIndexSize = nBuckets * INDEX_WAYS * sizeof(Slot);
+        if (nSize < sizeof(Header) + nIndexSize + 4096) {
+            printf("HTTPDiskCache::Open : %lu bytes is too small\n", (unsigned long)nSize);
+            lock_file(F_UNLCK);
+            close(fd);
+            fd = -1;
+            return false;
+        }
+
+        /* Emptied first, so no stale index or record is mapped in, then
+         * marked as ours straight away so a crash from here on leaves a file
+         * which can still be set up again. */
+        uint32_t nMagic = MAGIC;
+        nMapSize = nSize;
+        if (ftruncate(fd, 0) != 0 || pwrite(fd, &nMagic, sizeof(nMagic), 0) != sizeof(nMagic) || ftruncate(fd, nMapSize) != 0) {
+            printf("HTTPDiskCache::Open : can't size %s: %s\n", path.c_str(), strerror(errno));
+            lock_file(F_UNLCK);
+            close(fd);
+            fd = -1;
+            return false;
+        }
+    }
+
+    void *addr = mmap(NULL, nMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        printf("HTTPDiskCache::Open : can't map %s: %s\n", path.c_str(), strerror(errno));
+        lock_file(F_UNLCK);
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    map = (char*)addr;
+
+    if (!fValid) {
+        Header *hdr = header();
+        hdr->nBuckets = std::max<uint64_t>(nMapSize >> 15, 16);
+        hdr->nRingSize = nMapSize - sizeof(Header) - hdr->nBuckets * INDEX_WAYS * sizeof(Slot);
+        hdr->nCursor.store(0);
+        // The version goes in last, a file set up half way is set up again.
+        std::atomic_thread_fence(std::memory_order_release);
+        hdr->nVersion = VERSION;
+        msync(map, sizeof(Header), MS_SYNC);
+    }
+
+    lock_file(F_UNLCK);
+    return true;
+}
+
+void HTTPDiskCache::Close() {
+    boost::lock_guard<boost::mutex> lock(writeMutex);
+    if (map)
+        munmap(map, nMapSize);
+    if (fd >= 0)
+        close(fd);
+
+    map = NULL;
+    fd = -1;
+    nMapSize = 0;
+}
+
+bool HTTPDiskCache::read(const Slot &slot, uint64_t h, const std::string &key, std::string &value) {
+    Header *hdr = header();
+    uint64_t nPos = slot.nPos.load(std::memory_order_acquire);
+    if (slot.nHash.load(std::memory_order_acquire) != h)
+        return false;
+
+    if (!live(nPos, sizeof(Record), hdr->nCursor.load(std::memory_order_acquire)))
+        return false;
+
+    Record record;
+    const char *data = ring() + nPos % hdr->nRingSize;
+    memcpy(&record, data, sizeof(record));
+    uint64_t nSize = sizeof(Record) + (uint64_t)record.nKeySize + record.nValueSize;
+    if (record.nMagic != RECORD_MAGIC || record.nHash != h || record.nKeySize != key.size() || nPos % hdr->nRingSize + nSize > hdr->nRingSize)
+        return false;
+
+    std::string copy(data + sizeof(Record), record.nKeySize + record.nValueSize);
+    // Only now is it known whether the copy was overwritten while being made.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (!live(nPos, nSize, hdr->nCursor.load(std::memory_order_acquire)) || checksum(copy.data(), copy.size()) != record.nCRC || copy.compare(0, key.size(), key) != 0) {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        stats.nCorrupt++;
+        return false;
+    }
+
+    value.assign(copy, key.size(), std::string::npos);
+    return true;
+}
+
+bool HTTPDiskCache::Get(const std::string &key, std::string &value) {
+    if (!map)
+        return false;
+
+    uint64_t h = hash(key);
+    Slot *slots = bucket(h);
+    bool fFound = false;
+    for (int i = 0; i < INDEX_WAYS && !fFound; i++)
+        fFound = read(slots[i], h, key, value);
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    stats.nLookups++;
+    if (fFound)
+        stats.nHits++;
+
+    return fFound;
+}
+
+bool HTTPDiskCache::Put(const std::string &key, const std::string &value) {
+    if (!map)
+        return false;
+
+    Header *hdr = header();
+    uint64_t nSize = align(sizeof(Record) + key.size() + value.size());
+    if (nSize > hdr->nRingSize / 4 || key.size() > UINT32_MAX || value.size() > UINT32_MAX)
+        return false;
+
+    Record record;
+    record.nMagic = RECORD_MAGIC;
+    record.nHash = hash(key);
+    record.nKeySize = key.size();
+    record.nValueSize = value.size();
+    boost::crc_32_type crc;
+    crc.process_bytes(key.data(), key.size());
+    crc.process_bytes(value.data(), value.size());
+    record.nCRC = crc.checksum();
+
+    boost::lock_guard<boost::mutex> lock(writeMutex);
+    if (!lock_file(F_WRLCK))
+        return false;
+
+    // Records don't wrap, one which won't fit before the end starts over.
+    uint64_t nPos = hdr->nCursor.load();
+    if (nPos % hdr->nRingSize + nSize > hdr->nRingSize)
+        nPos += hdr->nRingSize - nPos % hdr->nRingSize;
+
+    // Move the cursor over the space first, readers of whatever was there
+    // then know it is gone before any of it changes.
+    hdr->nCursor.store(nPos + nSize);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    char *data = ring() + nPos % hdr->nRingSize;
+    memcpy(data, &record, sizeof(record));
+    memcpy(data + sizeof(record), key.data(), key.size());
+    memcpy(data + sizeof(record) + key.size(), value.data(), value.size());
+
+    // The key's own slot, or else an unused one, or else the oldest.
+    Slot *slots = bucket(record.nHash);
+    Slot *target = NULL;
+    for (int i = 0; i < INDEX_WAYS && !target; i++) {
+        if (slots[i].nHash.load() == record.nHash)
+            target = &slots[i];
+    }
+    for (int i = 0; i < INDEX_WAYS && !target; i++) {
+        if (slots[i].nHash.load() == 0 || !live(slots[i].nPos.load(), sizeof(Record), nPos + nSize))
+            target = &slots[i];
+    }
+    if (!target) {
+        target = &slots[0];
+        for (int i = 1; i < INDEX_WAYS; i++) {
+            if (slots[i].nPos.load() < target->nPos.load())
+                target = &slots[i];
+        }
+    }
+
+    // Cleared while it moves, so it never pairs one key's hash with another's record.
+    target->nHash.store(0, std::memory_order_release);
+    target->nPos.store(nPos, std::memory_order_release);
+    target->nHash.store(record.nHash, std::memory_order_release);
+    lock_file(F_UNLCK);
+
+    boost::lock_guard<boost::mutex> statsLock(mutex);
+    stats.nStored++;
+    return true;
+}
+
+void HTTPDiskCache::Erase(const std::string &key) {
+    if (!map)
+        return;
+
+    uint64_t h = hash(key);
+    Slot *slots = bucket(h);
+    boost::lock_guard<boost::mutex> lock(writeMutex);
+    if (!lock_file(F_WRLCK))
+        return;
+
+    for (int i = 0; i < INDEX_WAYS; i++) {
+        if (slots[i].nHash.load() == h)
+            slots[i].nHash.store(0, std::memory_order_release);
+    }
+
+    lock_file(F_UNLCK);
+}
+
+#endif // _DISKCACHE_HPP_
@@ -0,0 +1,268 @@
+#ifndef _HEDGING_HPP_
+#define _HEDGING_HPP_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <asyncclient.hpp>
+
+struct HTTPHedgePolicy {
+    HTTPHedgePolicy() : nDelay(50), dPercentile(0.95), nMinSamples(20), dMaxRate(0.05) {}
+
+    /** How long (in milliseconds) a request may take before it is hedged,
+     * used until nMinSamples requests have completed, or always when
+     * dPercentile is 0. */
+    unsigned int nDelay;
+    /** Hedge a request once it has taken longer than this fraction of recent
+     * requests took, e.g. 0.95 hedges the slowest 5%. */
+    double dPercentile;
+    unsigned int nMinSamples;
+    /** Hedges allowed as a fraction of the requests made, so a slow server
+     * isn't sent twice the traffic just as it is struggling. */
+    double dMaxRate;
+};
+
+struct HTTPHedgeStats {
+    /** Requests which could be hedged (GET or HEAD). */
+    uint64_t nRequests;
+    /** Requests a duplicate was sent for. */
+    uint64_t nHedged;
+    /** Hedged requests answered by the duplicate first. */
+    uint64_t nWon;
+    /** Requests which were due a hedge but went over dMaxRate. */
+    uint64_t nThrottled;
+};
+
+class HTTPHedgedRequest;
+
+/** Cuts tail latency for read-only requests by sending a duplicate of any
+ * which is taking unusually long, over another connection, and using
+ * whichever response arrives first. The other request is cancelled.
+ *
+ * Only GET and HEAD are hedged, anything else goes straight through. How long
+ * is unusual is either a fixed delay or a live percentile of recent request
+ * latencies, and hedges are rationed to a fraction of the traffic. Hedges are
+ * timed on HTTPWatchdog's thread, so any HTTPRequester can be wrapped:
+ *
+ *     HTTPHedgingClient hedged(engine);
+ *     hedged.AsyncRequest(server, port, request, true, handler); */
+class HTTPHedgingClient : public HTTPRequester {
+    public:
+        HTTPHedgingClient(HTTPRequester &innerIn, const HTTPHedgePolicy &policyIn = HTTPHedgePolicy()) : inner(innerIn), policy(policyIn), stats(HTTPHedgeStats()) {
+            samples.reserve(SAMPLE_COUNT);
+            nSample = 0;
+            nDelay = std::chrono::microseconds(policy.nDelay * 1000);
+            dBudget = 0;
+        }
+
+        void AsyncRequest(const std::string &/*server*/, const std::string &/*port*/, const HTTPRequest &/*request*/, bool fUseSSL, HTTPResponseHandler /*handler*/);
+
+        HTTPHedgeStats GetStats() {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            return stats;
+        }
+
+        /** How long a request currently waits before it is hedged. */
+        std::chrono::microseconds GetDelay() {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            return nDelay;
+        }
+
+    private:
+        friend class HTTPHedgedRequest;
+
+        /* Latencies the percentile is taken over, and how many new ones come
+         * in before it is worked out again. */
+        enum { SAMPLE_COUNT = 256, SAMPLE_INTERVAL = 16 };
+        /* Unused hedges carried over, so a burst of slow requests can all be
+         * hedged without letting a quiet spell build up an unlimited budget. */
+        enum { MAX_BUDGET = 10 };
+
+        bool take_hedge();
+        void record(std::chrono::microseconds /*latency*/, bool fWon);
+
+        HTTPRequester &inner;
+        const HTTPHedgePolicy policy;
+
+        boost::mutex mutex;
+        HTTPHedgeStats stats;
+        /** Recent latencies in microseconds, a ring once it is full. */
+        std::vector<uint32_t> samples;
+        std::size_t nSample;
+        std::chrono::microseconds nDelay;
+        double dBudget;
+};
+
+/** A hedged request in flight: the original, and once the delay is up, the
+ * duplicate. Kept alive by their handlers and the hedge alarm. */
+class HTTPHedgedRequest : public boost::enable_shared_from_this<HTTPHedgedRequest> {
+    public:
+        HTTPHedgedRequest(HTTPHedgingClient &clientIn, const std::string &serverIn, const std::string &portIn, const HTTPRequest &requestIn, bool fUseSSLIn, HTTPResponseHandler handlerIn) : client(clientIn), server(serverIn), port(portIn), request(requestIn), handler(handlerIn) {
+            fUseSSL = fUseSSLIn;
+            fDone = false;
+            nOutstanding = 0;
+            for (int i = 0; i < 2; i++)
+                signals[i] = boost::make_shared<HTTPCancelSignal>();
+        }
+
+        void Start(std::chrono::microseconds /*delay*/);
+
+    private:
+        void launch(int /*i*/);
+        void fire();
+        void handle_response(int /*i*/, const HTTPResponse &/*response*/);
+        void cancel_all();
+
+        HTTPHedgingClient &client;
+        const std::string server;
+        const std::string port;
+        const HTTPRequest request;
+        HTTPResponseHandler handler;
+        bool fUseSSL;
+        std::chrono::steady_clock::time_point start;
+        /** One for the original and one for the hedge. */
+        boost::shared_ptr<HTTPCancelSignal> signals[2];
+
+        boost::mutex mutex;
+        boost::shared_ptr<HTTPAlarm> alarm;
+        bool fDone;
+        int nOutstanding;
+};
+
+void HTTPHedgedRequest::Start(std::chrono::microseconds delay) {
+    start = std::chrono::steady_clock::now();
+    // The caller cancelling stops both.
+    if (request.GetCancel())
+        request.GetCancel()->Connect(boost::bind(&HTTPHedgedRequest::cancel_all, shared_from_this()));
+
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        nOutstanding = 1;
+        alarm = HTTPWatchdog::Global().Arm(start + delay, boost::bind(&HTTPHedgedRequest::fire, shared_from_this()));
+    }
+
+    launch(0);
+}
+
+void HTTPHedgedRequest::launch(int i) {
+    HTTPRequest attempt(request);
+    attempt.SetCancel(signals[i]);
+    client.inner.AsyncRequest(server, port, attempt, fUseSSL, boost::bind(&HTTPHedgedRequest::handle_response, shared_from_this(), i, _1));
+}
+
+/* Runs on the watchdog thread once the original has taken too long. */
+void HTTPHedgedRequest::fire() {
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        // This is the alarm running, disarming it from here would deadlock.
+        alarm.reset();
+        if (fDone)
+            return;
+
+        if (!client.take_hedge())
+            return;
+
+        nOutstanding++;
+    }
+
+    launch(1);
+}
+
+void HTTPHedgedRequest::handle_response(int i, const HTTPResponse &response) {
+    boost::shared_ptr<HTTPAlarm> pending;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        nOutstanding--;
+        if (fDone)
+            return;
+
+        // A failure only counts once there is nothing left which could succeed.
+        if (response.ec && nOutstanding > 0)
+            return;
+
+        fDone = true;
+        pending.swap(alarm);
+    }
+
+    if (pending)
+        pending->Disarm();
+    signals[1 - i]->Cancel();
+    if (request.GetCancel())
+        request.GetCancel()->Disconnect();
+
+    if (!response.ec)
+        client.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start), i == 1);
+    handler(response);
+}
+
+void HTTPHedgedRequest::cancel_all() {
+    boost::shared_ptr<HTTPAlarm> pending;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        pending.swap(alarm);
+    }
+
+    if (pending)
+        pending->Disarm();
+    signals[0]->Cancel();
+    signals[1]->Cancel();
+}
+
+void HTTPHedgingClient::AsyncRequest(const std::string &server, const std::string &port, const HTTPRequest &request, bool fUseSSL, HTTPResponseHandler handler) {
+    const std::string &head = request.GetHead();
+    // Both copies would feed a streamed body to the one sink.
+    if ((head.compare(0, 4, "GET ") != 0 && head.compare(0, 5, "HEAD ") != 0) || request.GetBodySink()) {
+        inner.AsyncRequest(server, port, request, fUseSSL, handler);
+        return;
+    }
+
+    std::chrono::microseconds delay;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        stats.nRequests++;
+        dBudget = std::min<double>(dBudget + policy.dMaxRate, MAX_BUDGET);
+        delay = nDelay;
+    }
+
+    boost::shared_ptr<HTTPHedgedRequest> req = boost::make_shared<HTTPHedgedRequest>(boost::ref(*this), server, port, request, fUseSSL, handler);
+    req->Start(delay);
+}
+
+/* Called with the request's lock held, never the other way round. */
+bool HTTPHedgingClient::take_hedge() {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (dBudget < 1) {
+        stats.nThrottled++;
+        return false;
+    }
+
+    dBudget -= 1;
+    stats.nHedged++;
+    return true;
+}
+
+void HTTPHedgingClient::record(std::chrono::microseconds latency, bool fWon) {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (fWon)
+        stats.nWon++;
+
+    uint32_t nLatency = (uint32_t)std::min<int64_t>(latency.count(), UINT32_MAX);
+    if (samples.size() < SAMPLE_COUNT)
+        samples.push_back(nLatency);
+    else
+        samples[nSample % SAMPLE_COUNT] = nLatency;
+    nSample++;
+
+    if (policy.dPercentile <= 0 || samples.size() < policy.nMinSamples || nSample % SAMPLE_INTERVAL != 0)
+        return;
+
+    std::vector<uint32_t> sorted(samples);
+    std::size_t n = std::min(sorted.size() - 1, (std::size_t)(policy.dPercentile * sorted.size()));
+    std::nth_element(sorted.begin(), sorted.begin() + n, sorted.end());
+    nDelay = std::chrono::microseconds(sorted[n]);
+}
+
+#endif // _HEDGING_HPP_
@@ -1,16 +1,27 @@
 #ifndef _HTTPCLIENT_HPP_
 #define _HTTPCLIENT_HPP_
 
+#include <algorithm>
+#include <deque>
+
+#include <boost/algorithm/string.hpp>
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 #include <boost/bind.hpp>
 #include <boost/iostreams/stream.hpp>
+#include <boost/utility/string_view.hpp>
 
 #include <json_spirit/json_spirit.h>
+#include <json_spirit/json_spirit_push_reader.h>
 
-namespace {
-    typedef boost::asio::ssl::stream<boost::asio::ip::tcp::socket> SSLStream;
+#include <connectionpool.hpp>
+#include <contentcoding.hpp>
+#include <deadline.hpp>
+#include <httpheaders.hpp>
+#include <httprequest.hpp>
+#include <resolvercache.hpp>
 
+namespace {
     bool valid_status(unsigned int status_code, std::string headers, bool printheaders = false) {
         if (printheaders && status_code != 200) {
             printf("%s\n", headers.c_str());
@@ -36,171 +47,1168 @@ namespace {
 
         return true;
     }
+
+    /* Check if a request uses a method which can safely be sent again (RFC
+     * 7231 4.2.2). */
+    bool is_idempotent(const std::string &request) {
+        static const char *methods[] = {"GET ", "HEAD ", "PUT ", "DELETE ", "OPTIONS ", "TRACE "};
+        for (std::size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+            if (request.compare(0, strlen(methods[i]), methods[i]) == 0)
+                return true;
+        }
+
+        return false;
+    }
 } // namespace
 
+/** The outcome of a request. */
+struct HTTPResponse {
+    HTTPResponse() : nStatus(0), nLatency(0) {}
+
+    /** The value of a header, empty when the response doesn't have it. */
+    boost::string_view GetHeader(HTTPHeaderId id) const {
+        return index.Get(headers, id);
+    }
+
+    boost::string_view GetHeader(boost::string_view name) const {
+        return index.Find(headers, name);
+    }
+
+    /** Parse the body into json unless it already holds the parsed value
+     * (e.g. for a response out of a cache). Returns false if the body isn't
+     * JSON. */
+    bool ParseJSON() {
+        if (json)
+            return true;
+
+        boost::shared_ptr<json_spirit::Value> val = boost::make_shared<json_spirit::Value>();
+        if (!json_spirit::read(body, *val))
+            return false;
+
+        json = val;
+        return true;
+    }
+
+    /** Set when no complete response could be read; status, headers and body
+     * are only meaningful when this is clear. */
+    boost::system::error_code ec;
+    unsigned int nStatus;
+    /** The status line and header lines, joined with newlines. */
+    std::string headers;
+    /** Where each header is in headers. */
+    HTTPHeaderIndex index;
+    std::string body;
+    /** The body as JSON once ParseJSON has been called, shared by every copy
+     * of the response and never modified. */
+    boost::shared_ptr<const json_spirit::Value> json;
+    /** How long the server took to answer, from the request being written
+     * to the response head arriving, so none of getting a connection, DNS,
+     * connecting or the TLS handshake. 0 when it wasn't measured. */
+    std::chrono::microseconds nLatency;
+};
+
+/** Status line and headers of a response, along with what they say about how
+ * the body is framed and whether the connection can be reused. */
+struct HTTPResponseHead {
+    HTTPResponseHead() : nStatus(0), fKeepAlive(false), fChunked(false), nContentLength(-1) {}
+
+    /** Consume the status line and headers from a buffer holding at least the
+     * complete head, leaving only body bytes behind. */
+    bool Parse(boost::asio::streambuf &/*sb*/);
+
+    /** Check if a response to this request carries a body at all; responses
+     * to HEAD and 1xx/204/304 responses never do, whatever the headers say. */
+    bool HasBody(const std::string &request) const {
+        return request.compare(0, 5, "HEAD ") != 0 && nStatus >= 200 && nStatus != 204 && nStatus != 304;
+    }
+
+    /** Check if this is an interim response, 1xx other than 101, which
+     * comes ahead of the real response to the same request (RFC 7231 6.2). */
+    bool IsInterim() const {
+        return nStatus >= 100 && nStatus < 200 && nStatus != 101;
+    }
+
+    /** How much more of a Content-Length body to make room for and read
+     * once nHave bytes of it are in. The length is only the server's word, so
+     * room is made as the body arrives, doubling from BODY_RESERVE, rather
+     * than all at once. */
+    std::size_t NextRead(std::size_t nHave) const {
+        return std::min<std::size_t>(nContentLength - nHave, std::max<std::size_t>(nHave, BODY_RESERVE));
+    }
+
+    /** Check if the body can only be ended by the server closing the
+     * connection, the last resort of RFC 7230 3.3.3. */
+    bool IsCloseDelimited() const {
+        return !fChunked && nContentLength < 0;
+    }
+
+    boost::string_view GetHeader(HTTPHeaderId id) const {
+        return index.Get(headers, id);
+    }
+
+    boost::string_view GetHeader(boost::string_view name) const {
+        return index.Find(headers, name);
+    }
+
+    /** The status line and header lines, joined with newlines. */
+    std::string headers;
+    HTTPHeaderIndex index;
+    unsigned int nStatus;
+    /** Set when the server allows the connection to be reused after this
+     * response. */
+    bool fKeepAlive;
+    /** Set when the body is sent with the chunked transfer coding. */
+    bool fChunked;
+    /** Body length announced by the server, -1 when not given. */
+    long long nContentLength;
+    /** How the body was compressed, empty when it wasn't. */
+    std::string strContentEncoding;
+
+    private:
+        enum { BODY_RESERVE = 1 << 20 };
+
+        bool parse_status_line(const char */*data*/, const char */*end*/);
+};
+
+/* Grab the http version and status code from the status line. */
+bool HTTPResponseHead::parse_status_line(const char *data, const char *end) {
+    const char *space = (const char*)memchr(data, ' ', end - data);
+    if (!space || space - data < 5 || memcmp(data, "HTTP/", 5) != 0) {
+        printf("HTTPResponseHead::parse_status_line : invalid response from server\n");
+        return false;
+    }
+
+    // HTTP/1.1 connections are persistent unless the server says otherwise.
+    fKeepAlive = !(space - data == 8 && memcmp(data, "HTTP/1.0", 8) == 0);
+
+    const char *p = space;
+    while (p < end && *p == ' ')
+        p++;
+
+    nStatus = 0;
+    const char *digits = p;
+    while (p < end && p - digits < 3 && *p >= '0' && *p <= '9')
+        nStatus = nStatus * 10 + (*p++ - '0');
+
+    if (p == digits || (p < end && *p != ' ')) {
+        printf("HTTPResponseHead::parse_status_line : invalid status code\n");
+        return false;
+    }
+
+    return true;
+}
+
+/* Parse the head in one pass over the buffer. Each line is copied once into
+ * headers, its name and value indexed where they land, and the headers which
+ * decide how the body is framed and whether the connection can be reused are
+ * dealt with on the way. A value folded onto more lines (obs-fold) is joined
+ * back into one, each fold becoming a space (RFC 7230 3.2.4). Returns false
+ * when the head is incomplete or has a line ending in a bare LF, or the
+ * framing headers can't be trusted. */
+bool HTTPResponseHead::Parse(boost::asio::streambuf &sb) {
+    const char *data = boost::asio::buffer_cast<const char*>(sb.data());
+    const char *end = data + sb.size();
+    headers.clear();
+    index.Clear();
+    strContentEncoding.clear();
+    nContentLength = -1;
+    fChunked = false;
+
+    const char *eol = find_crlf(data, end);
+    if (!eol || !parse_status_line(data, eol))
+        return false;
+    headers.append(data, eol - data);
+
+    // Views into headers don't survive it growing, so this one is kept as offsets.
+    std::size_t nTransferEncoding = 0, nTransferEncodingLen = 0;
+    bool fTransferEncoding = false;
+    bool fInvalidLength = false;
+    const char *p = eol + 2;
+    while ((eol = find_crlf(p, end)) != p) {
+        if (!eol) {
+            printf("HTTPResponseHead::Parse : incomplete head\n");
+            return false;
+        }
+        if (memchr(p, '\n', eol - p)) {
+            printf("HTTPResponseHead::Parse : bare LF in head\n");
+            return false;
+        }
+
+        std::size_t nLine = headers.size() + 1;
+        headers += '\n';
+        headers.append(p, eol - p);
+
+        /* Lines which aren't headers are kept but not indexed, as is a fold
+         * with no header before it to continue. */
+        const char *colon = (const char*)memchr(p, ':', eol - p);
+        if (!colon || colon == p || *p == ' ' || *p == '\t') {
+            p = eol + 2;
+            continue;
+        }
+
+        std::size_t nNameLen = colon - p;
+        p = eol + 2;
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            eol = find_crlf(p, end);
+            if (!eol) {
+                printf("HTTPResponseHead::Parse : incomplete head\n");
+                return false;
+            }
+            if (memchr(p, '\n', eol - p)) {
+                printf("HTTPResponseHead::Parse : bare LF in head\n");
+                return false;
+            }
+
+            while (p < eol && (*p == ' ' || *p == '\t'))
+                p++;
+            headers += ' ';
+            headers.append(p, eol - p);
+            p = eol + 2;
+        }
+
+        std::size_t nValue = nLine + nNameLen + 1;
+        std::size_t nValueEnd = headers.size();
+        while (nValue < nValueEnd && (headers[nValue] == ' ' || headers[nValue] == '\t'))
+            nValue++;
+        while (nValueEnd > nValue && (headers[nValueEnd - 1] == ' ' || headers[nValueEnd - 1] == '\t'))
+            nValueEnd--;
+
+        boost::string_view value(headers.data() + nValue, nValueEnd - nValue);
+        switch (index.Add(headers, nLine, nNameLen, nValue, value.size())) {
+            case HEADER_CONTENT_LENGTH: {
+                long long nLength = -1;
+                if (!value.empty() && value.size() <= 18 && value.find_first_not_of("0123456789") == boost::string_view::npos) {
+                    nLength = 0;
+                    for (std::size_t i = 0; i < value.size(); i++)
+                        nLength = nLength * 10 + (value[i] - '0');
+                }
+
+                // Repeats are only allowed when they all agree.
+                if (nLength < 0 || (nContentLength >= 0 && nContentLength != nLength))
+                    fInvalidLength = true;
+                nContentLength = nLength;
+                break;
+            }
+            case HEADER_TRANSFER_ENCODING:
+                if (!value.empty()) {
+                    fTransferEncoding = true;
+                    nTransferEncoding = nValue;
+                    nTransferEncodingLen = value.size();
+                }
+                break;
+            case HEADER_CONTENT_ENCODING:
+                strContentEncoding.assign(value.data(), value.size());
+                break;
+            case HEADER_CONNECTION:
+                if (value.size() == 5 && iequals_ascii(value.data(), "close", 5))
+                    fKeepAlive = false;
+                else if (value.size() == 10 && iequals_ascii(value.data(), "keep-alive", 10))
+                    fKeepAlive = true;
+                break;
+            default:
+                break;
+        }
+    }
+
+    sb.consume(p + 2 - data);
+
+    // After 101 the connection no longer speaks HTTP.
+    if (nStatus == 101)
+        fKeepAlive = false;
+
+    /* A transfer coding overrides any Content-Length, and unless chunked is
+     * the final coding the body runs until the connection closes (RFC 7230
+     * 3.3.3). A response with both is how messages get smuggled, so nothing
+     * after it on the connection is trusted. */
+    if (fTransferEncoding) {
+        if (nContentLength >= 0 || fInvalidLength)
+            fKeepAlive = false;
+
+        boost::string_view transfer_encoding(headers.data() + nTransferEncoding, nTransferEncodingLen);
+        std::size_t comma = transfer_encoding.rfind(',');
+        boost::string_view last = comma == boost::string_view::npos ? transfer_encoding : transfer_encoding.substr(comma + 1);
+        while (!last.empty() && (last.front() == ' ' || last.front() == '\t'))
+            last.remove_prefix(1);
+        fChunked = last.size() == 7 && iequals_ascii(last.data(), "chunked", 7);
+        nContentLength = -1;
+        return true;
+    }
+
+    if (fInvalidLength) {
+        printf("HTTPResponseHead::Parse : invalid Content-Length\n");
+        return false;
+    }
+
+    return true;
+}
+
+/** Incremental decoder for the chunked transfer coding (RFC 7230 4.1). Bytes
+ * can be fed in however they arrive off the wire; the decoder keeps its place
+ * between calls and says when the final chunk and trailer have been seen, so
+ * the caller never has to read further than the end of the message. */
+class HTTPChunkedDecoder {
+    public:
+        HTTPChunkedDecoder() {
+            Reset();
+        }
+
+        void Reset() {
+            state = CHUNK_SIZE;
+            nChunkLeft = 0;
+            nSizeDigits = 0;
+            fLineEmpty = true;
+        }
+
+        /** Decode up to size bytes of data, appending body bytes to body.
+         * Returns how many bytes were used, which is less than size only once
+         * the message is complete (or broken); anything left over belongs to
+         * whatever follows on the connection. */
+        std::size_t Decode(const char */*data*/, std::size_t /*size*/, std::string &/*body*/);
+
+        bool IsDone() const {
+            return state == DONE;
+        }
+
+        bool IsError() const {
+            return state == ERROR;
+        }
+
+    private:
+        enum State {
+            CHUNK_SIZE,     // hex digits of the chunk size
+            CHUNK_EXT,      // anything after the size up to the end of the line
+            CHUNK_DATA,
+            CHUNK_DATA_END, // the CRLF after the chunk data
+            TRAILER,        // trailer lines after the last chunk, up to an empty one
+            DONE,
+            ERROR
+        };
+
+        State state;
+        unsigned long long nChunkLeft;
+        unsigned int nSizeDigits;
+        bool fLineEmpty;
+};
+
+std::size_t HTTPChunkedDecoder::Decode(const char *data, std::size_t size, std::string &body) {
+    std::size_t i = 0;
+    while (i < size && state != DONE && state != ERROR) {
+        char c = data[i];
+        switch (state) {
+            case CHUNK_SIZE:
+                if (isxdigit((unsigned char)c)) {
+                    // Anything over 15 hex digits can't be a real chunk.
+                    if (++nSizeDigits > 15) {
+                        state = ERROR;
+                        break;
+                    }
+                    nChunkLeft = nChunkLeft * 16 + (isdigit((unsigned char)c) ? c - '0' : (tolower((unsigned char)c) - 'a' + 10));
+                    i++;
+                } else if (nSizeDigits == 0) {
+                    state = ERROR;
+                } else {
+                    state = CHUNK_EXT;
+                }
+                break;
+            case CHUNK_EXT:
+                // Extensions are ignored, and so is a missing CR.
+                i++;
+                if (c != '\n')
+                    break;
+
+                nSizeDigits = 0;
+                if (nChunkLeft == 0) {
+                    state = TRAILER;
+                    fLineEmpty = true;
+                } else {
+                    state = CHUNK_DATA;
+                }
+                break;
+            case CHUNK_DATA: {
+                std::size_t n = size - i;
+                if (n > nChunkLeft)
+                    n = nChunkLeft;
+
+                body.append(data + i, n);
+                i += n;
+                nChunkLeft -= n;
+                if (nChunkLeft == 0)
+                    state = CHUNK_DATA_END;
+                break;
+            }
+            case CHUNK_DATA_END:
+                i++;
+                if (c == '\n')
+                    state = CHUNK_SIZE;
+                else if (c != '\r')
+                    state = ERROR;
+                break;
+            case TRAILER:
+                i++;
+                if (c == '\n') {
+                    if (fLineEmpty)
+                        state = DONE;
+                    fLineEmpty = true;
+                } else if (c != '\r') {
+                    fLineEmpty = false;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    return i;
+}
+
 class SSLIOStreamDevice : public boost::iostreams::device<boost::iostreams::bidirectional> {
     public:
-        SSLIOStreamDevice(SSLStream &streamIn, bool fUseSSLIn) : stream(streamIn) {
+        SSLIOStreamDevice(SSLStream &streamIn, bool fUseSSLIn) : stream(&streamIn), pool(NULL), guard(boost::make_shared<HTTPSocketGuard>()) {
             fUseSSL = fUseSSLIn;
             fNeedHandshake = fUseSSLIn;
         }
 
-        bool HandleRequest(const std::string /*server*/, const std::string /*port*/, const std::string request, std::string &/*headers*/, bool printheaders = false);
+        /** Create a device which checks connections out of (and returns them
+         * to) a keep-alive pool instead of connecting on every request. */
+        SSLIOStreamDevice(HTTPConnectionPool &poolIn, bool fUseSSLIn) : stream(NULL), pool(&poolIn), guard(boost::make_shared<HTTPSocketGuard>()) {
+            fUseSSL = fUseSSLIn;
+            fNeedHandshake = fUseSSLIn;
+        }
 
-        /** Read the contents of the buffer into a string. */
+        ~SSLIOStreamDevice() {
+            release(false, false);
+        }
+
+        /** Send a request and read the response into the buffer. The
+         * request's timeouts, and cancelling it through its handle (see
+         * HTTPRequest::MakeCancellable) from another thread, are enforced by
+         * shutting the socket down under whatever call is blocked; the request
+         * then fails and GetError says why. A cancel can't cut short waiting
+         * for a pooled connection or a DNS lookup, the request stops as soon
+         * as either is done. */
+        bool HandleRequest(const std::string /*server*/, const std::string /*port*/, const HTTPRequest &/*request*/, std::string &/*headers*/, bool printheaders = false);
+
+        /** HandleRequest, but the body is handed to sinkIn as each read
+         * completes (with any chunked coding removed) instead of being
+         * collected, so it can be processed while the rest is still on the
+         * wire. */
+        bool HandleStreamingRequest(const std::string /*server*/, const std::string /*port*/, const HTTPRequest &/*request*/, std::string &/*headers*/, HTTPBodySink /*sinkIn*/, bool printheaders = false);
+
+        /** Send a request and parse the body as a JSON object while it
+         * downloads, so the object is ready as soon as the last byte is. */
+        bool HandleJSONRequest(const std::string /*server*/, const std::string /*port*/, const HTTPRequest &/*request*/, std::string &/*headers*/, json_spirit::Object &/*obj*/, bool printheaders = false);
+
+        /** Send a batch of requests to one host over a single connection,
+         * keeping up to nDepth of them in flight ahead of the response being
+         * read, and collect the responses in request order. If the server
+         * closes the connection part way through, requests it never answered
+         * are sent again on a new connection when their method is idempotent
+         * and fail otherwise. Returns true when every request got a response,
+         * whatever its status. */
+        bool HandlePipeline(const std::string /*server*/, const std::string /*port*/, const std::vector<std::string> &/*requests*/, std::vector<HTTPResponse> &/*responses*/, unsigned int nDepth = 8);
+
+        /** Read the contents of the buffer into a string, the body is moved
+         * rather than copied when strBuffer starts out empty. */
         void ReadToString(std::string &/*strBuffer*/);
         /** Read the contents of the buffer into a JSON object. */
         bool ReadToJSON(json_spirit::Object &/*obj*/);
         /** Check if a client buffer object is empty. */
         bool IsBufferEmpty() {
-            if (sb_.in_avail() <= 0)
-                return true;
+            return body_.empty();
+        }
 
-            return false;
+        /** The body of the last response, exactly as received (after any
+         * chunked coding is removed). The view is contiguous and only valid
+         * until the next request or TakeBody. */
+        boost::string_view GetBody() const {
+            return boost::string_view(body_);
+        }
+
+        /** Why the last request failed, a timeout error (see is_timeout) when
+         * it ran out of time. */
+        boost::system::error_code GetError() const {
+            return error;
+        }
+
+        /** A header of the last response, valid until the next request. */
+        boost::string_view GetHeader(HTTPHeaderId id) const {
+            return head.GetHeader(id);
+        }
+
+        boost::string_view GetHeader(boost::string_view name) const {
+            return head.GetHeader(name);
+        }
+
+        /** Move the body of the last response out without copying it,
+         * leaving the buffer empty. */
+        void TakeBody(std::string &strBody) {
+            strBody.swap(body_);
+            body_.clear();
         }
 
     private:
         void handshake(boost::asio::ssl::stream_base::handshake_type role) {
             if (!fNeedHandshake) return;
             fNeedHandshake = false;
-            stream.handshake(role);
+            if (!conn) {
+                stream->handshake(role);
+                return;
+            }
+
+            boost::system::error_code ec;
+            conn->Handshake(ec);
+            if (ec)
+                throw boost::system::system_error(ec);
         }
 
         std::size_t read_all(boost::system::error_code &ec) {
             handshake(boost::asio::ssl::stream_base::server); // HTTPS servers read first
             if (fUseSSL)
-                return boost::asio::read(stream, sb_, boost::asio::transfer_at_least(1), ec);
+                return boost::asio::read(*stream, sb_, boost::asio::transfer_at_least(1), ec);
+
+            return boost::asio::read(stream->next_layer(), sb_, boost::asio::transfer_at_least(1), ec);
+        }
+
+        /* Read straight into the caller's memory, so large bodies land where
+         * they'll be kept without passing through sb_. */
+        std::size_t read_exactly(boost::asio::mutable_buffer buffer, boost::system::error_code &ec) {
+            handshake(boost::asio::ssl::stream_base::server); // HTTPS servers read first
+            if (fUseSSL)
+                return boost::asio::read(*stream, boost::asio::buffer(buffer), boost::asio::transfer_all(), ec);
 
-            return boost::asio::read(stream.next_layer(), sb_, boost::asio::transfer_at_least(1), ec);
+            return boost::asio::read(stream->next_layer(), boost::asio::buffer(buffer), boost::asio::transfer_all(), ec);
+        }
+
+        std::size_t read_all(std::string &data, boost::system::error_code &ec) {
+            handshake(boost::asio::ssl::stream_base::server); // HTTPS servers read first
+            if (fUseSSL)
+                return boost::asio::read(*stream, boost::asio::dynamic_buffer(data), boost::asio::transfer_at_least(1), ec);
+
+            return boost::asio::read(stream->next_layer(), boost::asio::dynamic_buffer(data), boost::asio::transfer_at_least(1), ec);
         }
 
         std::size_t read_until(std::string delimeter, boost::system::error_code &ec) {
             handshake(boost::asio::ssl::stream_base::server); // HTTPS servers read first
             if (fUseSSL)
-                return boost::asio::read_until(stream, sb_, delimeter, ec);
+                return boost::asio::read_until(*stream, sb_, delimeter, ec);
 
-            return boost::asio::read_until(stream.next_layer(), sb_, delimeter, ec);
+            return boost::asio::read_until(stream->next_layer(), sb_, delimeter, ec);
         }
 
-        std::size_t write(boost::system::error_code &ec) {
+        /* Write every part of a request at once. TLS would make a record of
+         * each part, so there they are gathered into sb_ first. */
+        std::size_t write(const HTTPRequest &request, boost::system::error_code &ec) {
+            handshake(boost::asio::ssl::stream_base::client); // HTTPS clients write first
+            if (fUseSSL) {
+                sb_.consume(sb_.size());
+                sb_.commit(boost::asio::buffer_copy(sb_.prepare(request.Size()), request.GetBuffers()));
+                return boost::asio::write(*stream, sb_, ec);
+            }
+
+            return boost::asio::write(stream->next_layer(), request.GetBuffers(), ec);
+        }
+
+        /* Write data directly, leaving anything already read in sb_ alone. */
+        std::size_t write(const std::string &data, boost::system::error_code &ec) {
             handshake(boost::asio::ssl::stream_base::client); // HTTPS clients write first
             if (fUseSSL)
-                return boost::asio::write(stream, sb_, ec);
+                return boost::asio::write(*stream, boost::asio::buffer(data), ec);
 
-            return boost::asio::write(stream.next_layer(), sb_, ec);
+            return boost::asio::write(stream->next_layer(), boost::asio::buffer(data), ec);
         }
 
-        bool connect(const std::string& server, const std::string& port) {
-            boost::asio::ip::tcp::resolver resolver(stream.get_io_service());
-            boost::asio::ip::tcp::resolver::query query(server.c_str(), port.c_str());
-            boost::asio::ip::tcp::resolver::iterator endpoint_iterator = resolver.resolve(query);
-            boost::asio::ip::tcp::resolver::iterator end;
+        bool connect(const std::string& server, const std::string& port, bool &fReused) {
+            fReused = false;
+            if (pool) {
+                conn = pool->Acquire(server, port, fUseSSL, fReused);
+                if (!conn) {
+                    error = boost::asio::error::would_block;
+                    return false;
+                }
+
+                stream = &conn->stream;
+                fNeedHandshake = fUseSSL && !fReused;
+                if (fReused) {
+                    guard->SetSocket(stream->lowest_layer().native_handle());
+                    return true;
+                }
+            }
+
+            std::vector<boost::asio::ip::tcp::endpoint> endpoints;
+            boost::system::error_code ec;
+            HTTPTimeoutError phase = HTTP_TIMEOUT_RESOLVE;
+            std::chrono::steady_clock::time_point limit = phase_end(timeouts.nResolve, phase);
+            unsigned int nResolve = 0;
+            if (limit != std::chrono::steady_clock::time_point())
+                nResolve = std::max<long>(1, std::chrono::duration_cast<std::chrono::milliseconds>(limit - std::chrono::steady_clock::now()).count());
+            if (!HTTPResolverCache::Global().Resolve(server, port, endpoints, ec, nResolve)) {
+                error = ec == boost::asio::error::timed_out ? make_timeout_error(phase) : ec;
+                printf("SSLIOStreamDevice::connect : error resolving %s %s\n", server.c_str(), error.message().c_str());
+                return false;
+            }
+
+            // A lookup can't be interrupted, so see if we were while it ran.
+            error = guard->Aborted();
+            if (!error && pool && pool->IsShutdown())
+                error = boost::asio::error::operation_aborted;
+            if (error)
+                return false;
 
             if (fUseSSL) {
                 certificate_name.clear(); // Initialize for good measure.
-                stream.set_verify_mode(boost::asio::ssl::verify_peer);
-                stream.set_verify_callback(boost::bind(&SSLIOStreamDevice::verify_certificate, this, _1, _2));
+                stream->set_verify_mode(boost::asio::ssl::verify_peer);
+                stream->set_verify_callback(boost::bind(&SSLIOStreamDevice::verify_certificate, this, _1, _2));
             }
 
-            boost::system::error_code ec = boost::asio::error::host_not_found;
-            while (ec && endpoint_iterator != end) {
-                stream.lowest_layer().close();
-                stream.lowest_layer().connect(*endpoint_iterator++, ec);
+            phase = HTTP_TIMEOUT_CONNECT;
+            limit = phase_end(timeouts.nConnect, phase);
+            if (!HTTPConnector::Connect(stream->next_layer(), server, port, endpoints, ec, limit, guard.get())) {
+                error = guard->Aborted();
+                if (error)
+                    return false;
+
+                error = ec == boost::asio::error::timed_out ? make_timeout_error(phase) : ec;
+                // The cached addresses may be stale, look them up again next time.
+                HTTPResolverCache::Global().Invalidate(server, port);
+                return false;
             }
-            if (ec)
+
+            /* Requests are written whole, so Nagle only ever holds back the
+             * next pipelined batch waiting on an ack. */
+            stream->lowest_layer().set_option(boost::asio::ip::tcp::no_delay(true), ec);
+            guard->SetSocket(stream->lowest_layer().native_handle());
+
+            return true;
+        }
+
+        /** Hand a pooled connection back, keeping it alive only if the last
+         * response was read completely and the server allows reuse. */
+        void release(bool fReusable, bool fClean = true) {
+            guard->SetSocket(-1);
+            if (!conn)
+                return;
+
+            if (fReusable)
+                conn->nRequests++;
+            pool->Release(conn, fReusable, fClean);
+            conn.reset();
+        }
+
+        /* Deadline and cancel handling, the request in progress has its
+         * timeouts and cancel signal hooked up by begin_request until
+         * end_request. */
+        void begin_request(const HTTPRequest &/*request*/);
+        void end_request();
+        void begin_phase(HTTPTimeoutError /*phase*/, unsigned int /*nTimeout*/);
+        void end_phase();
+
+        /** When a phase allowed nTimeout has to end by, which is the total
+         * deadline instead (with phase set to HTTP_TIMEOUT_TOTAL) when that
+         * comes first. */
+        std::chrono::steady_clock::time_point phase_end(unsigned int nTimeout, HTTPTimeoutError &phase) const {
+            std::chrono::steady_clock::time_point limit;
+            if (nTimeout)
+                limit = std::chrono::steady_clock::now() + std::chrono::milliseconds(nTimeout);
+            if (end != std::chrono::steady_clock::time_point() && (limit == std::chrono::steady_clock::time_point() || end < limit)) {
+                limit = end;
+                phase = HTTP_TIMEOUT_TOTAL;
+            }
+
+            return limit;
+        }
+
+        /* An error caused by an alarm or a cancel shutting the socket down is
+         * reported as whichever of them did it. */
+        bool fail(boost::system::error_code &ec) {
+            boost::system::error_code reason = guard->Aborted();
+            if (reason)
+                ec = reason;
+            error = ec;
+            return false;
+        }
+
+        /* Give up on a request which was aborted before any of it was sent.
+         * The connection is as good as it was, unless the abort interrupted
+         * it or it still needs a handshake, so it goes back to the pool. */
+        bool abandon_unsent() {
+            error = guard->Aborted();
+            if (!error)
                 return false;
 
+            release(!guard->Interrupted() && !fNeedHandshake);
+            printf("SSLIOStreamDevice::HandleRequest : %s before sending\n", error.message().c_str());
             return true;
         }
 
-        bool getHTTPVersion(std::string &/*headers*/, unsigned int &/*status_code*/);
-        void extract_headers(std::string &/*headers*/);
+        bool exchange(const std::string &/*server*/, const std::string &/*port*/, const HTTPRequest &/*request*/, std::string &/*headers*/, bool /*printheaders*/);
+        bool read_body(const std::string &/*request*/, boost::system::error_code &/*ec*/);
+        bool read_direct(boost::system::error_code &/*ec*/);
+        bool read_chunked(boost::system::error_code &/*ec*/);
+        bool read_staged(boost::system::error_code &/*ec*/);
+
+        /* Pass body bytes on to the body or the sink, decompressing them
+         * first if they were sent compressed. */
+        bool emit(const char *data, std::size_t size, boost::system::error_code &ec) {
+            std::string &out = sink ? scratch_ : body_;
+            if (sink && !content.IsActive())
+                return deliver(data, size, ec);
+
+            scratch_.clear();
+            if (!content.Decode(data, size, out)) {
+                ec = boost::system::errc::make_error_code(boost::system::errc::bad_message);
+                return false;
+            }
+
+            return !sink || scratch_.empty() || deliver(scratch_.data(), scratch_.size(), ec);
+        }
+
+        bool deliver(const char *data, std::size_t size, boost::system::error_code &ec) {
+            // Nothing more is parsed once the request has been cancelled.
+            if (guard->Aborted()) {
+                ec = boost::asio::error::operation_aborted;
+                return false;
+            }
+
+            if (sink(data, size))
+                return true;
+
+            ec = boost::system::errc::make_error_code(boost::system::errc::operation_canceled);
+            return false;
+        }
+
+        bool feed_json(json_spirit::Push_reader<json_spirit::Value> *reader, const char *data, std::size_t size) {
+            // Error pages aren't JSON, let them go by unparsed.
+            if (head.nStatus != 200)
+                return true;
+
+            return reader->feed(data, size);
+        }
+
         bool verify_certificate(bool /*preverified*/, boost::asio::ssl::verify_context &/*ctx*/);
 
         bool fNeedHandshake;
         bool fUseSSL;
-        SSLStream& stream;
+        HTTPResponseHead head;
+        SSLStream *stream;
+        HTTPConnectionPool *pool;
+        boost::shared_ptr<HTTPConnection> conn;
         boost::asio::streambuf sb_;
+        /** The body of the last response, kept apart from sb_ so it can be
+         * handed out whole. */
+        std::string body_;
+        /** Set for the duration of a streaming request. */
+        HTTPBodySink sink;
+        /** Decompressed output waiting to go to the sink. */
+        std::string scratch_;
+        HTTPContentDecoder content;
         std::string certificate_name;
+        HTTPTimeouts timeouts;
+        /** The total deadline of the request in progress, if it has one. */
+        std::chrono::steady_clock::time_point end;
+        boost::shared_ptr<HTTPSocketGuard> guard;
+        boost::shared_ptr<HTTPAlarm> totalAlarm;
+        boost::shared_ptr<HTTPAlarm> phaseAlarm;
+        boost::shared_ptr<HTTPCancelSignal> cancel;
+        boost::system::error_code error;
 };
 
-/* Grab the html version and status code from our buffer object and append them
- * to a header string. */
-bool SSLIOStreamDevice::getHTTPVersion(std::string &headers, unsigned int &status_code) {
-    std::string html_version;
-    std::istream is(&sb_);
+bool SSLIOStreamDevice::HandleRequest(const std::string server, const std::string port, const HTTPRequest &request, std::string &headers, bool printheaders) {
+    begin_request(request);
+    bool fOk = exchange(server, port, request, headers, printheaders);
+    end_request();
+
+    return fOk;
+}
+
+bool SSLIOStreamDevice::exchange(const std::string &server, const std::string &port, const HTTPRequest &request, std::string &headers, bool printheaders) {
+    boost::system::error_code ec;
+    size_t sz;
+    bool fReused;
+
+    /* A pooled connection can still be closed by the server after passing the
+     * liveness check, so when nothing at all comes back on a reused connection
+     * try again on another one (unless it was us who closed it). */
+    while (true) {
+        if (!connect(server, port, fReused)) {
+            printf("SSLIOStreamDevice::HandleRequest : error connecting to server %s on port %s %s\n", server.c_str(), port.c_str(), error.message().c_str());
+            return false;
+        }
+
+        if (abandon_unsent())
+            return false;
+
+        if (fNeedHandshake) {
+            begin_phase(HTTP_TIMEOUT_HANDSHAKE, timeouts.nHandshake);
+            try {
+                handshake(boost::asio::ssl::stream_base::client);
+            } catch (const boost::system::system_error &e) {
+                ec = e.code();
+            }
+            end_phase();
+            if (ec) {
+                fail(ec);
+                printf("SSLIOStreamDevice::HandleRequest : error in handshake %s\n", ec.message().c_str());
+                return false;
+            }
+        }
+
+        if (abandon_unsent())
+            return false;
+
+        begin_phase(HTTP_TIMEOUT_FIRST_BYTE, timeouts.nFirstByte);
+        sz = write(request, ec);
+        sb_.consume(sb_.size());
+        if (ec != boost::system::errc::success || sz <= 0) {
+            if (fReused && !guard->Aborted()) {
+                release(false, false);
+                continue;
+            }
 
-    is >> html_version;
-    is >> status_code;
+            fail(ec);
+            printf("SSLIOStreamDevice::HandleRequest : error writing to request stream %s\n", ec.message().c_str());
+            return false;
+        }
+
+        sz = read_until("\r\n\r\n", ec);
+        if (ec != boost::system::errc::success || sz <= 0) {
+            if (fReused && sb_.size() == 0 && !guard->Aborted()) {
+                release(false, false);
+                continue;
+            }
+
+            fail(ec);
+            printf("SSLIOStreamDevice::HandleRequest : error reading response %s\n", ec.message().c_str());
+            return false;
+        }
 
-    if (html_version.substr(0, 4) != "HTTP") {
-        printf("HTTPClient::getHTTPVersion : invalid response from server\n");
+        end_phase();
+        break;
+    }
+
+    // Don't go on to parse a response nobody wants any more.
+    if (guard->Aborted()) {
+        fail(ec);
+        printf("SSLIOStreamDevice::HandleRequest : %s\n", ec.message().c_str());
+        return false;
+    }
+
+    /* A body running until the connection closes ends the same way as one cut
+     * short by an abort, so check for that even when the read succeeded. */
+    if (!read_body(request.GetHead(), ec) || guard->Aborted()) {
+        if (!ec)
+            ec = boost::asio::error::operation_aborted;
+        fail(ec);
+        printf("SSLIOStreamDevice::HandleRequest : error reading body %s\n", ec.message().c_str());
         return false;
     }
 
-    headers = html_version;
-    headers += " ";
-    headers += std::to_string(status_code);
+    headers = head.headers;
+
+    // Anything past the end of the body means we've lost track of framing.
+    release(head.fKeepAlive && sb_.size() == 0);
+    error = boost::system::error_code();
+
+    if (!valid_status(head.nStatus, headers, printheaders))
+        return false;
+
+    if (printheaders)
+        printf("%s\n", headers.c_str());
 
     return true;
 }
 
-void SSLIOStreamDevice::extract_headers(std::string &headers) {
-    std::istream is(&sb_);
-    std::string header;
-    unsigned int i = 0;
-    while (getline(is, header) && header != "\r") {
-        if (i != 0)
-            headers += "\n";
+bool SSLIOStreamDevice::HandlePipeline(const std::string server, const std::string port, const std::vector<std::string> &requests, std::vector<HTTPResponse> &responses, unsigned int nDepth) {
+    responses.assign(requests.size(), HTTPResponse());
+    if (nDepth == 0)
+        nDepth = 1;
+
+    std::deque<std::size_t> pending;
+    for (std::size_t i = 0; i < requests.size(); i++)
+        pending.push_back(i);
+
+    bool fAllAnswered = true;
+    while (!pending.empty()) {
+        bool fReused;
+        if (!connect(server, port, fReused)) {
+            printf("SSLIOStreamDevice::HandlePipeline : error connecting to server %s on port %s\n", server.c_str(), port.c_str());
+            for (std::size_t i = 0; i < pending.size(); i++)
+                responses[pending[i]].ec = boost::asio::error::not_connected;
+
+            return false;
+        }
+
+        boost::system::error_code ec;
+        std::size_t nSent = 0;
+        std::size_t nAnswered = 0;
+        bool fOpen = true;
+        sb_.consume(sb_.size());
+        while (fOpen && nAnswered < pending.size()) {
+            /* Top the pipeline back up once it has half drained, so the
+             * server always has requests queued without a write per
+             * response. */
+            if (nSent < pending.size() && nSent - nAnswered <= nDepth / 2) {
+                std::string batch;
+                while (nSent < pending.size() && nSent - nAnswered < nDepth)
+                    batch += requests[pending[nSent++]];
 
-        headers += header;
-        i++;
+                if (write(batch, ec) != batch.size())
+                    break;
+            }
+
+            // Nothing at all coming back means the server closed on us.
+            if (read_until("\r\n\r\n", ec) == 0 && sb_.size() == 0)
+                break;
+
+            std::size_t i = pending[nAnswered++];
+            HTTPResponse &response = responses[i];
+            if (ec || !read_body(requests[i], ec)) {
+                if (!ec)
+                    ec = boost::system::errc::make_error_code(boost::system::errc::protocol_error);
+                response.ec = ec;
+                fAllAnswered = false;
+                fOpen = false;
+                break;
+            }
+
+            response.nStatus = head.nStatus;
+            response.headers = head.headers;
+            response.index = head.index;
+            response.body.swap(body_);
+            body_.clear();
+            fOpen = head.fKeepAlive;
+        }
+
+        bool fDone = fOpen && nAnswered == pending.size();
+        release(fDone && sb_.size() == 0, fDone);
+        if (fDone)
+            break;
+
+        /* A fresh connection which didn't answer anything won't do better
+         * next time, give up on whatever is left. */
+        if (nAnswered == 0 && !fReused) {
+            printf("SSLIOStreamDevice::HandlePipeline : error reading response %s\n", ec ? ec.message().c_str() : "connection closed");
+            for (std::size_t i = 0; i < pending.size(); i++)
+                responses[pending[i]].ec = ec ? ec : boost::asio::error::connection_reset;
+
+            return false;
+        }
+
+        /* Requests which were sent but never answered may or may not have
+         * been acted on, so only send the ones which are safe to repeat. */
+        std::deque<std::size_t> retry;
+        for (std::size_t n = nAnswered; n < pending.size(); n++) {
+            std::size_t i = pending[n];
+            if (n < nSent && !is_idempotent(requests[i])) {
+                responses[i].ec = boost::asio::error::connection_aborted;
+                fAllAnswered = false;
+            } else {
+                retry.push_back(i);
+            }
+        }
+        pending.swap(retry);
     }
+
+    return fAllAnswered;
 }
 
-bool SSLIOStreamDevice::HandleRequest(const std::string server, const std::string port, const std::string request, std::string &headers, bool printheaders) {
-    if (!connect(server, port)) {
-        printf("SSLIOStreamDevice::HandleRequest : error connecting to server %s on port %s\n", server.c_str(), port.c_str());
-        return false;
+void SSLIOStreamDevice::begin_request(const HTTPRequest &request) {
+    timeouts = request.GetTimeouts();
+    guard->Reset();
+    error = boost::system::error_code();
+    end = timeouts.End(std::chrono::steady_clock::now());
+    if (end != std::chrono::steady_clock::time_point())
+        totalAlarm = HTTPWatchdog::Global().Arm(end, boost::bind(&HTTPSocketGuard::Expire, guard, HTTP_TIMEOUT_TOTAL));
+
+    cancel = request.GetCancel();
+    if (cancel)
+        cancel->Connect(boost::bind(&HTTPSocketGuard::Abort, guard, boost::system::error_code(boost::asio::error::operation_aborted)));
+}
+
+void SSLIOStreamDevice::end_request() {
+    end_phase();
+    if (totalAlarm) {
+        totalAlarm->Disarm();
+        totalAlarm.reset();
     }
 
-    std::ostream os(&sb_);
-    os << request;
+    if (cancel) {
+        cancel->Disconnect();
+        cancel.reset();
+    }
 
-    boost::system::error_code ec;
-    size_t sz;
-    sz = write(ec);
-    if (ec != boost::system::errc::success || sz <= 0) {
-        printf("SSLIOStreamDevice::HandleRequest : error writing to request stream %s\n", ec.message().c_str());
+    // A connection still checked out here failed part way, don't reuse it.
+    release(false, false);
+    timeouts = HTTPTimeouts();
+    end = std::chrono::steady_clock::time_point();
+}
+
+void SSLIOStreamDevice::begin_phase(HTTPTimeoutError phase, unsigned int nTimeout) {
+    end_phase();
+    if (nTimeout)
+        phaseAlarm = HTTPWatchdog::Global().Arm(std::chrono::steady_clock::now() + std::chrono::milliseconds(nTimeout), boost::bind(&HTTPSocketGuard::Expire, guard, phase));
+}
+
+void SSLIOStreamDevice::end_phase() {
+    if (!phaseAlarm)
+        return;
+
+    phaseAlarm->Disarm();
+    phaseAlarm.reset();
+}
+
+/* Parse the head at the front of the buffer and read the body into body_ as
+ * its framing says, stopping as soon as the message is complete. Anything read
+ * past the end of the body is left in sb_. */
+bool SSLIOStreamDevice::read_body(const std::string &request, boost::system::error_code &ec) {
+    body_.clear();
+    if (!head.Parse(sb_)) {
+        ec = boost::system::errc::make_error_code(boost::system::errc::protocol_error);
         return false;
     }
 
-    sz = read_until("\r\n", ec);
-    if (ec != boost::system::errc::success || sz <= 0) {
-        printf("SSLIOStreamDevice::HandleRequest : error reading response %s\n", ec.message().c_str());
+    // Skip any interim responses to get to the real one.
+    while (head.IsInterim()) {
+        if (read_until("\r\n\r\n", ec) == 0)
+            return false;
+
+        if (!head.Parse(sb_)) {
+            ec = boost::system::errc::make_error_code(boost::system::errc::protocol_error);
+            return false;
+        }
+    }
+
+    if (!head.HasBody(request)) {
+        head.fChunked = false;
+        head.nContentLength = 0;
+        return true;
+    }
+
+    if (!content.Init(head.strContentEncoding)) {
+        ec = boost::system::errc::make_error_code(boost::system::errc::not_supported);
         return false;
     }
 
-    unsigned int status_code = 0;
-    if (!getHTTPVersion(headers, status_code))
+    if (!head.fChunked && !sink && !content.IsActive())
+        return read_direct(ec);
+
+    if (!(head.fChunked ? read_chunked(ec) : read_staged(ec)))
         return false;
 
-    /* Read body til EOF (runs in a loop because it may return success with more
-     * pending) */
-    while (read_all(ec));
-    if (ec != boost::asio::error::eof) {
-        printf("SSLIOStreamDevice::HandleRequest : error reading body %s\n", ec.message().c_str());
+    if (content.IsActive() && !content.Finish()) {
+        printf("SSLIOStreamDevice::read_body : compressed body is truncated\n");
+        ec = boost::system::errc::make_error_code(boost::system::errc::bad_message);
         return false;
     }
 
-    extract_headers(headers);
+    return true;
+}
 
-    if (!valid_status(status_code, headers, printheaders))
+/* Read a plain body straight into body_. */
+bool SSLIOStreamDevice::read_direct(boost::system::error_code &ec) {
+    const char *data = boost::asio::buffer_cast<const char*>(sb_.data());
+    if (head.nContentLength >= 0) {
+        /* Take what came in with the head and read the rest directly into
+         * place. */
+        std::size_t nLength = head.nContentLength;
+        std::size_t nHave = std::min(nLength, sb_.size());
+        body_.assign(data, nHave);
+        sb_.consume(nHave);
+        while (body_.size() < nLength) {
+            std::size_t nRead = head.NextRead(body_.size());
+            body_.resize(body_.size() + nRead);
+            if (read_exactly(boost::asio::buffer(&body_[body_.size() - nRead], nRead), ec) != nRead)
+                return false;
+        }
+
+        return true;
+    }
+
+    /* Read body til EOF (runs in a loop because it may return success with
+     * more pending), the connection can't be reused after this. */
+    head.fKeepAlive = false;
+    body_.assign(data, sb_.size());
+    sb_.consume(sb_.size());
+    while (read_all(body_, ec));
+    if (ec != boost::asio::error::eof)
         return false;
 
-    if (printheaders)
-        printf("%s\n", headers.c_str());
+    ec = boost::system::error_code();
+    return true;
+}
+
+/* Decode a chunked body as it arrives, reading only while the decoder still
+ * needs more. */
+bool SSLIOStreamDevice::read_chunked(boost::system::error_code &ec) {
+    HTTPChunkedDecoder decoder;
+    // Plain bodies go straight to body_, anything else through emit.
+    bool fDirect = !sink && !content.IsActive();
+    std::string chunk;
+    while (true) {
+        const char *data = boost::asio::buffer_cast<const char*>(sb_.data());
+        sb_.consume(decoder.Decode(data, sb_.size(), fDirect ? body_ : chunk));
+        if (decoder.IsError()) {
+            ec = boost::system::errc::make_error_code(boost::system::errc::protocol_error);
+            return false;
+        }
+        if (!chunk.empty()) {
+            if (!emit(chunk.data(), chunk.size(), ec))
+                return false;
+            chunk.clear();
+        }
+        if (decoder.IsDone())
+            return true;
+        if (read_all(ec) == 0)
+            return false;
+    }
+}
+
+/* Pass the body on a read at a time, for bodies going to a sink or being
+ * decompressed. */
+bool SSLIOStreamDevice::read_staged(boost::system::error_code &ec) {
+    bool fLength = head.nContentLength >= 0;
+    std::size_t nLeft = fLength ? head.nContentLength : 0;
+    if (!fLength)
+        head.fKeepAlive = false;
+
+    while (true) {
+        std::size_t size = fLength ? std::min(nLeft, sb_.size()) : sb_.size();
+        if (size != 0 && !emit(boost::asio::buffer_cast<const char*>(sb_.data()), size, ec))
+            return false;
+
+        sb_.consume(size);
+        nLeft -= fLength ? size : 0;
+        if (fLength && nLeft == 0)
+            return true;
+
+        if (read_all(ec) == 0) {
+            if (fLength || ec != boost::asio::error::eof)
+                return false;
+
+            ec = boost::system::error_code();
+            return true;
+        }
+    }
+}
+
+bool SSLIOStreamDevice::HandleStreamingRequest(const std::string server, const std::string port, const HTTPRequest &request, std::string &headers, HTTPBodySink sinkIn, bool printheaders) {
+    sink = sinkIn;
+    bool fOk = HandleRequest(server, port, request, headers, printheaders);
+    sink.clear();
+
+    return fOk;
+}
 
+bool SSLIOStreamDevice::HandleJSONRequest(const std::string server, const std::string port, const HTTPRequest &request, std::string &headers, json_spirit::Object &obj, bool printheaders) {
+    json_spirit::Push_reader<json_spirit::Value> reader;
+    if (!HandleStreamingRequest(server, port, request, headers, boost::bind(&SSLIOStreamDevice::feed_json, this, &reader, _1, _2), printheaders))
+        return false;
+
+    if (!reader.finish() || reader.get_value().type() != json_spirit::obj_type) {
+        printf("SSLIOStreamDevice::HandleJSONRequest : response is not a JSON object\n");
+        return false;
+    }
+
+    obj.swap(reader.get_value().get_obj());
     return true;
 }
 
@@ -217,27 +1225,23 @@ bool SSLIOStreamDevice::verify_certificate(bool preverified, boost::asio::ssl::v
 }
 
 void SSLIOStreamDevice::ReadToString(std::string &strBuffer) {
-    std::istream is(&sb_);
-    std::string strLine;
-    unsigned int i = 0;
-    while(getline(is, strLine)) {
-        if (i != 0)
-            strBuffer += "\n";
+    if (strBuffer.empty())
+        strBuffer.swap(body_);
+    else
+        strBuffer += body_;
 
-        strBuffer += strLine;
-        i++;
-    }
+    body_.clear();
 }
 
 bool SSLIOStreamDevice::ReadToJSON(json_spirit::Object &obj) {
-    std::istream is(&sb_);
     json_spirit::Value val;
-    if (json_spirit::read(is, val)) {
-        obj = val.get_obj();
-        return true;
-    }
+    bool fRead = json_spirit::read(body_, val);
+    body_.clear();
+    if (!fRead || val.type() != json_spirit::obj_type)
+        return false;
 
-    return false;
+    obj = val.get_obj();
+    return true;
 }
 
 #endif // _HTTPCLIENT_HPP_
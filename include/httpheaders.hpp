@@ -0,0 +1,194 @@
+#ifndef _HTTPHEADERS_HPP_
+#define _HTTPHEADERS_HPP_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+
+#include <boost/container/small_vector.hpp>
+#include <boost/utility/string_view.hpp>
+
+/** Headers which can be looked up directly, without scanning the rest. */
+enum HTTPHeaderId {
+    HEADER_CONTENT_LENGTH,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_CONTENT_ENCODING,
+    HEADER_CONTENT_TYPE,
+    HEADER_CONNECTION,
+    HEADER_KEEP_ALIVE,
+    HEADER_DATE,
+    HEADER_AGE,
+    HEADER_ETAG,
+    HEADER_LAST_MODIFIED,
+    HEADER_CACHE_CONTROL,
+    HEADER_EXPIRES,
+    HEADER_VARY,
+    HEADER_LOCATION,
+    HEADER_RETRY_AFTER,
+    HEADER_X_RATELIMIT_LIMIT,
+    HEADER_X_RATELIMIT_REMAINING,
+    HEADER_X_RATELIMIT_RESET,
+    HEADER_COUNT,
+    HEADER_OTHER = HEADER_COUNT
+};
+
+namespace {
+    /* Compare n bytes ignoring ASCII case, header names are never anything
+     * else so there is no need to involve the locale. */
+    bool iequals_ascii(const char *a, const char *b, std::size_t n) {
+        for (std::size_t i = 0; i < n; i++) {
+            unsigned char x = a[i], y = b[i];
+            if (x == y)
+                continue;
+
+            x |= 0x20;
+            if (x != (y | 0x20) || x < 'a' || x > 'z')
+                return false;
+        }
+
+        return true;
+    }
+
+    /* Find the next CRLF, memchr does the scanning a vector at a time. */
+    const char *find_crlf(const char *p, const char *end) {
+        while (p < end) {
+            p = (const char*)memchr(p, '\r', end - p);
+            if (!p || p + 1 == end)
+                return NULL;
+            if (p[1] == '\n')
+                return p;
+            p++;
+        }
+
+        return NULL;
+    }
+} // namespace
+
+/** Where each header sits in a block of header text, as offsets rather than
+ * copies so indexing a header costs no allocation (unless a response has more
+ * than a few dozen of them). The headers in HTTPHeaderId are found in
+ * constant time; anything else is a scan over the names, still without
+ * touching the values. */
+class HTTPHeaderIndex {
+    public:
+        HTTPHeaderIndex() {
+            Clear();
+        }
+
+        void Clear() {
+            fields.clear();
+            for (int i = 0; i < HEADER_COUNT; i++)
+                known[i] = -1;
+        }
+
+        /** Record a header whose name and value are at the given offsets into
+         * text, returning which of the known headers it is. */
+        HTTPHeaderId Add(const std::string &/*text*/, std::size_t nName, std::size_t nNameLen, std::size_t nValue, std::size_t nValueLen);
+
+        /** The value of the first header of this kind, empty when there is
+         * none. */
+        boost::string_view Get(const std::string &text, HTTPHeaderId id) const {
+            if (id >= HEADER_COUNT || known[id] < 0)
+                return boost::string_view();
+
+            return value(text, fields[known[id]]);
+        }
+
+        boost::string_view Find(const std::string &/*text*/, boost::string_view /*name*/) const;
+
+        bool Has(HTTPHeaderId id) const {
+            return id < HEADER_COUNT && known[id] >= 0;
+        }
+
+        std::size_t Count() const {
+            return fields.size();
+        }
+
+        boost::string_view GetName(const std::string &text, std::size_t i) const {
+            return boost::string_view(text.data() + fields[i].nName, fields[i].nNameLen);
+        }
+
+        boost::string_view GetValue(const std::string &text, std::size_t i) const {
+            return value(text, fields[i]);
+        }
+
+        /** Which of the known headers a name is, ignoring case. */
+        static HTTPHeaderId Classify(const char */*name*/, std::size_t /*size*/);
+
+    private:
+        struct Field {
+            uint32_t nName;
+            uint32_t nNameLen;
+            uint32_t nValue;
+            uint32_t nValueLen;
+        };
+
+        static boost::string_view value(const std::string &text, const Field &field) {
+            return boost::string_view(text.data() + field.nValue, field.nValueLen);
+        }
+
+        boost::container::small_vector<Field, 32> fields;
+        /** Position in fields of the first header of each known kind. */
+        int16_t known[HEADER_COUNT];
+};
+
+HTTPHeaderId HTTPHeaderIndex::Classify(const char *name, std::size_t size) {
+    /* Same order as HTTPHeaderId. Names only need comparing when the length
+     * matches, which rules out nearly all of them straight away. */
+    static const struct {
+        const char *name;
+        std::size_t size;
+    } names[HEADER_COUNT] = {
+        {"Content-Length", 14},
+        {"Transfer-Encoding", 17},
+        {"Content-Encoding", 16},
+        {"Content-Type", 12},
+        {"Connection", 10},
+        {"Keep-Alive", 10},
+        {"Date", 4},
+        {"Age", 3},
+        {"ETag", 4},
+        {"Last-Modified", 13},
+        {"Cache-Control", 13},
+        {"Expires", 7},
+        {"Vary", 4},
+        {"Location", 8},
+        {"Retry-After", 11},
+        {"X-RateLimit-Limit", 17},
+        {"X-RateLimit-Remaining", 21},
+        {"X-RateLimit-Reset", 17}
+    };
+
+    for (int i = 0; i < HEADER_COUNT; i++) {
+        if (names[i].size == size && iequals_ascii(name, names[i].name, size))
+            return (HTTPHeaderId)i;
+    }
+
+    return HEADER_OTHER;
+}
+
+HTTPHeaderId HTTPHeaderIndex::Add(const std::string &text, std::size_t nName, std::size_t nNameLen, std::size_t nValue, std::size_t nValueLen) {
+    Field field = {(uint32_t)nName, (uint32_t)nNameLen, (uint32_t)nValue, (uint32_t)nValueLen};
+    HTTPHeaderId id = Classify(text.data() + nName, nNameLen);
+    if (id < HEADER_COUNT && known[id] < 0 && fields.size() < 0x7fff)
+        known[id] = fields.size();
+    fields.push_back(field);
+
+    return id;
+}
+
+boost::string_view HTTPHeaderIndex::Find(const std::string &text, boost::string_view name) const {
+    HTTPHeaderId id = Classify(name.data(), name.size());
+    if (id < HEADER_COUNT)
+        return Get(text, id);
+
+    for (std::size_t i = 0; i < fields.size(); i++) {
+        if (fields[i].nNameLen == name.size() && iequals_ascii(text.data() + fields[i].nName, name.data(), name.size()))
+            return value(text, fields[i]);
+    }
+
+    return boost::string_view();
+}
+
+#endif // _HTTPHEADERS_HPP_
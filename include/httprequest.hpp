@@ -0,0 +1,327 @@
+#ifndef _HTTPREQUEST_HPP_
+#define _HTTPREQUEST_HPP_
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <string>
+
+#include <boost/array.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/function.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility/string_view.hpp>
+
+#include <cancel.hpp>
+#include <deadline.hpp>
+#include <httpheaders.hpp>
+
+/** Takes each piece of a response body as it is read, returning false to
+ * abandon the response. */
+typedef boost::function<bool(const char*, std::size_t)> HTTPBodySink;
+
+/** A request ready to go on the wire, kept in three parts: the request line
+ * with headers of its own, a block of headers shared by every request from the
+ * same HTTPRequestBuilder, and the body. GetBuffers hands all three to a
+ * single gathering write, so they are never concatenated.
+ *
+ * A request which is already serialized (the way every call used to take
+ * them) converts implicitly and is sent as it is. */
+class HTTPRequest {
+    public:
+        typedef boost::array<boost::asio::const_buffer, 3> Buffers;
+
+        HTTPRequest() : fParseJSON(false) {}
+        HTTPRequest(const std::string &strRequest) : strHead(strRequest), fParseJSON(false) {}
+        HTTPRequest(const char *pszRequest) : strHead(pszRequest), fParseJSON(false) {}
+
+        /** Add a header to this request alone. Returns false for a request
+         * which wasn't built by HTTPRequestBuilder, or for a header which
+         * would break the framing. */
+        bool AddHeader(const std::string &/*name*/, const std::string &/*value*/);
+
+        /** Set the body, along with its Content-Length header. Call it at
+         * most once per request. */
+        bool SetBody(const std::string &/*strBodyIn*/);
+
+        /** Limit how long the request may take, see HTTPTimeouts. */
+        void SetTimeouts(const HTTPTimeouts &timeoutsIn) {
+            timeouts = timeoutsIn;
+        }
+
+        const HTTPTimeouts &GetTimeouts() const {
+            return timeouts;
+        }
+
+        /** Let the request be abandoned through signal once it has been
+         * started. Requests built from a builder start without one. */
+        void SetCancel(boost::shared_ptr<HTTPCancelSignal> signalIn) {
+            cancel = signalIn;
+        }
+
+        const boost::shared_ptr<HTTPCancelSignal> &GetCancel() const {
+            return cancel;
+        }
+
+        /** Have an HTTPRequester hand the body to sinkIn as each read
+         * completes (decompressed, with any chunked coding removed) instead
+         * of collecting it in the response. The sink is called on an
+         * io_service thread, for error pages too, and returning false
+         * abandons the request with operation_canceled. A body which went to
+         * a sink is never shared with other requests or cached. */
+        void SetBodySink(HTTPBodySink sinkIn) {
+            sink = sinkIn;
+        }
+
+        const HTTPBodySink &GetBodySink() const {
+            return sink;
+        }
+
+        /** Have an HTTPRequester parse the body of a 200 response as JSON
+         * while it downloads, so HTTPResponse::json is ready as soon as the
+         * last byte is. The body is still collected. */
+        void SetParseJSON(bool fParseJSONIn) {
+            fParseJSON = fParseJSONIn;
+        }
+
+        bool GetParseJSON() const {
+            return fParseJSON;
+        }
+
+        /** Get a handle which can cancel the request once it is started,
+         * whether by a blocking call on another thread or asynchronously. */
+        HTTPRequestHandle MakeCancellable() {
+            if (!cancel)
+                cancel = boost::make_shared<HTTPCancelSignal>();
+
+            return HTTPRequestHandle(cancel);
+        }
+
+        /** The buffers to write, in order. */
+        Buffers GetBuffers() const {
+            Buffers buffers = {{
+                boost::asio::buffer(strHead),
+                fixed ? boost::asio::buffer(*fixed) : boost::asio::const_buffer(),
+                boost::asio::buffer(strBody)
+            }};
+            return buffers;
+        }
+
+        /** The method and the target of the request line. */
+        boost::string_view GetMethod() const {
+            return boost::string_view(strHead.data(), std::min(strHead.find(' '), strHead.size()));
+        }
+
+        boost::string_view GetTarget() const {
+            std::size_t nStart = strHead.find(' ');
+            if (nStart == std::string::npos)
+                return boost::string_view();
+
+            nStart++;
+            std::size_t nEnd = strHead.find(' ', nStart);
+            if (nEnd == std::string::npos)
+                return boost::string_view();
+
+            return boost::string_view(strHead.data() + nStart, nEnd - nStart);
+        }
+
+        /** The value of a header the request carries, empty when it has
+         * none. */
+        boost::string_view GetHeader(boost::string_view name) const {
+            boost::string_view value;
+            if (find_header(strHead, name, value) || (fixed && find_header(*fixed, name, value)))
+                return value;
+
+            return boost::string_view();
+        }
+
+        /** Check if the request was passed in already serialized, which
+         * leaves no way to add headers to it. */
+        bool IsSerialized() const {
+            return !fixed;
+        }
+
+        /** Everything up to the fixed header block, starting with the request
+         * line. */
+        const std::string &GetHead() const {
+            return strHead;
+        }
+
+        std::size_t Size() const {
+            return strHead.size() + (fixed ? fixed->size() : 0) + strBody.size();
+        }
+
+        /** The whole request as one string, for logging or for the calls which
+         * still take a batch of strings. */
+        std::string ToString() const {
+            std::string str;
+            str.reserve(Size());
+            str.append(strHead);
+            if (fixed)
+                str.append(*fixed);
+            str.append(strBody);
+
+            return str;
+        }
+
+    private:
+        friend class HTTPRequestBuilder;
+
+        static bool valid_header(const std::string &name, const std::string &value) {
+            return !name.empty() && name.find_first_of(":\r\n") == std::string::npos && value.find_first_of("\r\n") == std::string::npos;
+        }
+
+        static bool find_header(const std::string &/*block*/, boost::string_view /*name*/, boost::string_view &/*value*/);
+
+        static void append_header(std::string &str, const std::string &name, const std::string &value) {
+            str.append(name);
+            str.append(": ", 2);
+            str.append(value);
+            str.append("\r\n", 2);
+        }
+
+        std::string strHead;
+        /** The builder's header block, ending the head with a blank line. Only
+         * built requests have one. */
+        boost::shared_ptr<const std::string> fixed;
+        std::string strBody;
+        HTTPTimeouts timeouts;
+        boost::shared_ptr<HTTPCancelSignal> cancel;
+        HTTPBodySink sink;
+        bool fParseJSON;
+};
+
+/** Serializes requests to one host without going through an ostream. The
+ * Host header and anything added with AddFixedHeader are formatted once into
+ * a block every request shares, so building a request only writes its request
+ * line and whatever headers are particular to it:
+ *
+ *     HTTPRequestBuilder builder("api.github.com");
+ *     builder.AddFixedHeader("User-Agent", "Irrational HTTPC");
+ *     HTTPRequest request = builder.Build("GET", "/users/IngCr3at1on");
+ *
+ * Building into an existing request reuses its buffers, so a request object
+ * kept around for repeated calls stops allocating once it has grown to fit. */
+class HTTPRequestBuilder {
+    public:
+        HTTPRequestBuilder(const std::string &/*strHost*/);
+
+        /** Add a header sent with every request built from now on. Requests
+         * built before keep the block they were built with. */
+        bool AddFixedHeader(const std::string &/*name*/, const std::string &/*value*/);
+
+        /** Timeouts given to every request built from now on. */
+        void SetTimeouts(const HTTPTimeouts &timeoutsIn) {
+            timeouts = timeoutsIn;
+        }
+
+        /** Start a request in req, replacing whatever it held. */
+        void Build(HTTPRequest &/*req*/, const std::string &/*method*/, const std::string &/*target*/) const;
+
+        HTTPRequest Build(const std::string &method, const std::string &target) const {
+            HTTPRequest req;
+            Build(req, method, target);
+            return req;
+        }
+
+    private:
+        /* Head space reserved up front for headers added after the request
+         * line, enough for a few without growing. */
+        enum { HEADER_RESERVE = 256 };
+
+        /** Fixed headers and the blank line ending the head. */
+        boost::shared_ptr<const std::string> fixed;
+        HTTPTimeouts timeouts;
+};
+
+bool HTTPRequest::AddHeader(const std::string &name, const std::string &value) {
+    if (!fixed) {
+        printf("HTTPRequest::AddHeader : request is already serialized\n");
+        return false;
+    }
+
+    if (!valid_header(name, value)) {
+        printf("HTTPRequest::AddHeader : invalid header %s\n", name.c_str());
+        return false;
+    }
+
+    append_header(strHead, name, value);
+    return true;
+}
+
+bool HTTPRequest::SetBody(const std::string &strBodyIn) {
+    if (!fixed) {
+        printf("HTTPRequest::SetBody : request is already serialized\n");
+        return false;
+    }
+
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%lu", (unsigned long)strBodyIn.size());
+    append_header(strHead, "Content-Length", buf);
+    strBody = strBodyIn;
+
+    return true;
+}
+
+bool HTTPRequest::find_header(const std::string &block, boost::string_view name, boost::string_view &value) {
+    const char *p = block.data();
+    const char *end = p + block.size();
+    while (p < end) {
+        const char *eol = find_crlf(p, end);
+        if (!eol)
+            eol = end;
+
+        if ((std::size_t)(eol - p) > name.size() && p[name.size()] == ':' && iequals_ascii(p, name.data(), name.size())) {
+            const char *v = p + name.size() + 1;
+            while (v < eol && (*v == ' ' || *v == '\t'))
+                v++;
+
+            value = boost::string_view(v, eol - v);
+            return true;
+        }
+
+        p = eol + 2;
+    }
+
+    return false;
+}
+
+HTTPRequestBuilder::HTTPRequestBuilder(const std::string &strHost) {
+    std::string block;
+    HTTPRequest::append_header(block, "Host", strHost);
+    block.append("\r\n", 2);
+    fixed = boost::make_shared<const std::string>(block);
+}
+
+bool HTTPRequestBuilder::AddFixedHeader(const std::string &name, const std::string &value) {
+    if (!HTTPRequest::valid_header(name, value)) {
+        printf("HTTPRequestBuilder::AddFixedHeader : invalid header %s\n", name.c_str());
+        return false;
+    }
+
+    // Copy rather than modify, requests already built may share the block.
+    std::string block(*fixed, 0, fixed->size() - 2);
+    HTTPRequest::append_header(block, name, value);
+    block.append("\r\n", 2);
+    fixed = boost::make_shared<const std::string>(block);
+
+    return true;
+}
+
+void HTTPRequestBuilder::Build(HTTPRequest &req, const std::string &method, const std::string &target) const {
+    req.strHead.clear();
+    req.strHead.reserve(method.size() + target.size() + 11 + HEADER_RESERVE);
+    req.strHead.append(method);
+    req.strHead.append(" ", 1);
+    req.strHead.append(target);
+    req.strHead.append(" HTTP/1.1\r\n", 11);
+    req.fixed = fixed;
+    req.strBody.clear();
+    req.timeouts = timeouts;
+    req.cancel.reset();
+    req.sink.clear();
+    req.fParseJSON = false;
+}
+
+#endif // _HTTPREQUEST_HPP_
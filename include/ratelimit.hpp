@@ -0,0 +1,376 @@
+#ifndef _RATELIMIT_HPP_
+#define _RATELIMIT_HPP_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <asyncclient.hpp>
+
+struct HTTPRateLimitPolicy {
+    HTTPRateLimitPolicy() : nBurst(5), nReserve(1) {}
+
+    /** Requests which can go straight out after a quiet spell, at most. */
+    unsigned int nBurst;
+    /** Requests of each window's quota left unused, for whatever else shares
+     * the same quota. */
+    unsigned int nReserve;
+};
+
+struct HTTPRateLimitStats {
+    uint64_t nRequests;
+    /** Requests held back to stay within a host's quota. */
+    uint64_t nDelayed;
+    /** Responses saying the quota had run out anyway (429, or 403 with none
+     * remaining). */
+    uint64_t nLimited;
+};
+
+/** How requests to a host are being paced right now. */
+struct HTTPRateLimitState {
+    /** Requests the host says are left this window, less those in flight,
+     * -1 until it has said. */
+    long nRemaining;
+    /** The window's whole quota, -1 until the host has said. */
+    long nLimit;
+    /** Requests per second the quota is being spread at, 0 while unknown. */
+    double dRate;
+    /** Requests which could go out right now. */
+    double dTokens;
+    std::size_t nQueued;
+    std::size_t nInFlight;
+    /** How long nothing will be sent for, after the host said to wait. */
+    std::chrono::milliseconds nBlocked;
+};
+
+/** Paces requests to each host to fit the quota it advertises, the way
+ * GitHub and many other APIs do with X-RateLimit-Limit, X-RateLimit-Remaining
+ * and X-RateLimit-Reset, rather than spending it all and then getting 403s
+ * until the window resets.
+ *
+ * Each host gets a token bucket refilled at whatever rate spreads its
+ * remaining quota evenly up to the reset, saving up to nBurst tokens.
+ * Requests wait in a queue per host for a token. Until a host has answered
+ * only one request at a time is sent to it, after that a host without the
+ * headers isn't held back. Retry-After (on a 429 or 503) and a 403 with
+ * nothing remaining stop all requests to the host until the time given.
+ * Requests are released on HTTPWatchdog's thread, so any HTTPRequester can be
+ * wrapped:
+ *
+ *     HTTPRateLimitingClient limited(engine);
+ *     limited.AsyncRequest(server, port, request, true, handler); */
+class HTTPRateLimitingClient : public HTTPRequester {
+    public:
+        HTTPRateLimitingClient(HTTPRequester &innerIn, const HTTPRateLimitPolicy &policyIn = HTTPRateLimitPolicy()) : inner(innerIn), policy(policyIn), stats(HTTPRateLimitStats()) {
+            nNextId = 0;
+        }
+
+        void AsyncRequest(const std::string &/*server*/, const std::string &/*port*/, const HTTPRequest &/*request*/, bool fUseSSL, HTTPResponseHandler /*handler*/);
+
+        HTTPRateLimitStats GetStats() {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            return stats;
+        }
+
+        /** The current budget and queue for a host. */
+        HTTPRateLimitState GetState(const std::string &/*server*/, const std::string &/*port*/);
+
+    private:
+        struct Pending {
+            uint64_t nId;
+            std::string server;
+            std::string port;
+            HTTPRequest request;
+            bool fUseSSL;
+            HTTPResponseHandler handler;
+        };
+
+        struct Host {
+            Host() : fAnswered(false), nRemaining(-1), nLimit(-1), dRate(0), dTokens(0), nInFlight(0), nAlarm(0) {}
+
+            /** Set once a response has come back, until then there is no
+             * knowing whether the host has a quota at all. */
+            bool fAnswered;
+            long nRemaining;
+            long nLimit;
+            double dRate;
+            double dTokens;
+            std::chrono::steady_clock::time_point refilled;
+            /** When the quota is due to be renewed. */
+            std::chrono::steady_clock::time_point reset;
+            std::chrono::steady_clock::time_point blocked;
+            std::deque<Pending> queue;
+            std::size_t nInFlight;
+            boost::shared_ptr<HTTPAlarm> alarm;
+            /** Counts alarms set, so one replaced just as it went off can
+             * tell. */
+            uint64_t nAlarm;
+        };
+
+        /* The rest are all called with mutex held. */
+        Host &host(const std::string &server, const std::string &port) {
+            return hosts[server + ":" + port];
+        }
+
+        void refill(Host &/*h*/, std::chrono::steady_clock::time_point /*now*/);
+        /* Take whatever can go out now off the queue, and set an alarm for
+         * the rest. */
+        void release(Host &/*h*/, std::vector<Pending> &/*ready*/);
+        void update(Host &/*h*/, const HTTPResponse &/*response*/);
+
+        void send(Pending &/*pending*/);
+        void handle_alarm(const std::string &/*key*/, uint64_t nAlarm);
+        void handle_response(const std::string &/*key*/, HTTPResponseHandler /*handler*/, const HTTPResponse &/*response*/);
+        void cancel_pending(const std::string &/*key*/, uint64_t nId);
+
+        /* Seconds, or an HTTP date, from now. */
+        static bool parse_retry_after(boost::string_view /*value*/, std::chrono::seconds &/*delay*/);
+
+        HTTPRequester &inner;
+        const HTTPRateLimitPolicy policy;
+
+        boost::mutex mutex;
+        std::map<std::string, Host> hosts;
+        uint64_t nNextId;
+        HTTPRateLimitStats stats;
+};
+
+void HTTPRateLimitingClient::refill(Host &h, std::chrono::steady_clock::time_point now) {
+    // The window is over, the host's own count will be back at its limit.
+    if (h.nRemaining >= 0 && now >= h.reset && h.reset != std::chrono::steady_clock::time_point()) {
+        h.nRemaining = h.nLimit;
+        h.dTokens = std::max<double>(h.dTokens, policy.nBurst);
+        h.reset = std::chrono::steady_clock::time_point();
+    }
+
+    if (h.dRate > 0)
+        h.dTokens += h.dRate * std::chrono::duration<double>(now - h.refilled).count();
+    h.dTokens = std::min<double>(h.dTokens, policy.nBurst);
+    if (h.nRemaining >= 0)
+        h.dTokens = std::min<double>(h.dTokens, std::max<long>(h.nRemaining - (long)policy.nReserve, 0));
+    h.refilled = now;
+}
+
+void HTTPRateLimitingClient::release(Host &h, std::vector<Pending> &ready) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    refill(h, now);
+    // A host not yet heard from gets one request at a time.
+    while (!h.queue.empty() && now >= h.blocked && (h.fAnswered || h.nInFlight == 0) && (h.nRemaining < 0 || h.dTokens >= 1)) {
+        if (h.nRemaining >= 0) {
+            h.dTokens -= 1;
+            h.nRemaining--;
+        }
+
+        h.nInFlight++;
+        ready.push_back(h.queue.front());
+        h.queue.pop_front();
+    }
+
+    if (h.queue.empty() || h.alarm)
+        return;
+
+    // Next token, or the end of the window when the quota is spent.
+    std::chrono::steady_clock::time_point when = now;
+    if (h.nRemaining >= 0 && (h.nRemaining <= (long)policy.nReserve || h.dRate <= 0))
+        when = h.reset;
+    else if (h.dRate > 0)
+        when = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>((1 - h.dTokens) / h.dRate));
+    when = std::max(when, h.blocked);
+    if (when <= now) {
+        // Only a response can say when, and with none to come, look again shortly.
+        if (h.nInFlight > 0)
+            return;
+        when = now + std::chrono::seconds(1);
+    }
+
+    h.alarm = HTTPWatchdog::Global().Arm(when, boost::bind(&HTTPRateLimitingClient::handle_alarm, this, h.queue.front().server + ":" + h.queue.front().port, ++h.nAlarm));
+}
+
+void HTTPRateLimitingClient::update(Host &h, const HTTPResponse &response) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    boost::string_view remaining = response.GetHeader(HEADER_X_RATELIMIT_REMAINING);
+    boost::string_view reset = response.GetHeader(HEADER_X_RATELIMIT_RESET);
+    boost::string_view limit = response.GetHeader(HEADER_X_RATELIMIT_LIMIT);
+    if (!remaining.empty() && !reset.empty()) {
+        refill(h, now);
+        // A host only just found to have a quota starts with a burst.
+        if (h.nRemaining < 0)
+            h.dTokens = policy.nBurst;
+
+        // Anything still in flight will be counted against what's left.
+        long nRemaining = strtol(std::string(remaining.data(), remaining.size()).c_str(), NULL, 10);
+        h.nRemaining = std::max<long>(nRemaining - (long)h.nInFlight, 0);
+        if (!limit.empty())
+            h.nLimit = strtol(std::string(limit.data(), limit.size()).c_str(), NULL, 10);
+
+        time_t nReset = strtol(std::string(reset.data(), reset.size()).c_str(), NULL, 10);
+        double dLeft = difftime(nReset, time(NULL));
+        h.reset = now + std::chrono::seconds((long)std::max(dLeft, 0.0) + 1);
+
+        long nUsable = std::max<long>(h.nRemaining - (long)policy.nReserve, 0);
+        h.dRate = dLeft > 0 ? nUsable / dLeft : 0;
+        h.dTokens = std::min<double>(h.dTokens, nUsable);
+        if (nRemaining == 0 && response.nStatus == 403) {
+            stats.nLimited++;
+            h.blocked = std::max(h.blocked, h.reset);
+        }
+    }
+
+    boost::string_view retryAfter = response.GetHeader(HEADER_RETRY_AFTER);
+    std::chrono::seconds delay;
+    if (response.nStatus == 429 || response.nStatus == 503) {
+        if (response.nStatus == 429)
+            stats.nLimited++;
+        if (!retryAfter.empty() && parse_retry_after(retryAfter, delay))
+            h.blocked = std::max(h.blocked, now + delay);
+    }
+}
+
+void HTTPRateLimitingClient::AsyncRequest(const std::string &server, const std::string &port, const HTTPRequest &request, bool fUseSSL, HTTPResponseHandler handler) {
+    std::vector<Pending> ready;
+    uint64_t nId;
+    bool fQueued;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        stats.nRequests++;
+        nId = nNextId++;
+    }
+
+    /* Connected before the request is queued, since from then on it can be
+     * sent at any moment and whatever it is sent through connects its own.
+     * Not under the lock, an already cancelled signal runs the slot straight
+     * away, and the request is then aborted once it is sent. */
+    if (request.GetCancel())
+        request.GetCancel()->Connect(boost::bind(&HTTPRateLimitingClient::cancel_pending, this, server + ":" + port, nId));
+
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        Host &h = host(server, port);
+        Pending pending = {nId, server, port, request, fUseSSL, handler};
+        h.queue.push_back(pending);
+        release(h, ready);
+        fQueued = ready.empty() || ready.back().nId != nId;
+        if (fQueued)
+            stats.nDelayed++;
+    }
+
+    for (std::size_t i = 0; i < ready.size(); i++)
+        send(ready[i]);
+}
+
+void HTTPRateLimitingClient::send(Pending &pending) {
+    inner.AsyncRequest(pending.server, pending.port, pending.request, pending.fUseSSL, boost::bind(&HTTPRateLimitingClient::handle_response, this, pending.server + ":" + pending.port, pending.handler, _1));
+}
+
+/* Runs on the watchdog thread once the next request can go. */
+void HTTPRateLimitingClient::handle_alarm(const std::string &key, uint64_t nAlarm) {
+    std::vector<Pending> ready;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        Host &h = hosts[key];
+        // Replaced by a response while waiting for the lock, the new one is due instead.
+        if (nAlarm != h.nAlarm)
+            return;
+
+        // This is the alarm running, disarming it from here would deadlock.
+        h.alarm.reset();
+        release(h, ready);
+    }
+
+    for (std::size_t i = 0; i < ready.size(); i++)
+        send(ready[i]);
+}
+
+void HTTPRateLimitingClient::handle_response(const std::string &key, HTTPResponseHandler handler, const HTTPResponse &response) {
+    std::vector<Pending> ready;
+    boost::shared_ptr<HTTPAlarm> stale;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        Host &h = hosts[key];
+        h.nInFlight--;
+        if (!response.ec) {
+            h.fAnswered = true;
+            update(h, response);
+            // The rate may have changed, so whatever was scheduled is out of date.
+            stale.swap(h.alarm);
+        }
+        release(h, ready);
+    }
+
+    /* Not under the lock, an alarm going off holds its own while it waits for
+     * ours. */
+    if (stale)
+        stale->Disarm();
+
+    for (std::size_t i = 0; i < ready.size(); i++)
+        send(ready[i]);
+
+    handler(response);
+}
+
+void HTTPRateLimitingClient::cancel_pending(const std::string &key, uint64_t nId) {
+    HTTPResponseHandler handler;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        std::deque<Pending> &queue = hosts[key].queue;
+        for (std::deque<Pending>::iterator it = queue.begin(); it != queue.end(); ++it) {
+            if (it->nId == nId) {
+                handler = it->handler;
+                queue.erase(it);
+                break;
+            }
+        }
+    }
+
+    // Already sent, cancelling is down to whatever it was sent through.
+    if (!handler)
+        return;
+
+    HTTPResponse response;
+    response.ec = boost::asio::error::operation_aborted;
+    handler(response);
+}
+
+HTTPRateLimitState HTTPRateLimitingClient::GetState(const std::string &server, const std::string &port) {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    Host &h = host(server, port);
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    refill(h, now);
+
+    HTTPRateLimitState state;
+    state.nRemaining = h.nRemaining;
+    state.nLimit = h.nLimit;
+    state.dRate = h.dRate;
+    state.dTokens = h.dTokens;
+    state.nQueued = h.queue.size();
+    state.nInFlight = h.nInFlight;
+    state.nBlocked = h.blocked > now ? std::chrono::duration_cast<std::chrono::milliseconds>(h.blocked - now) : std::chrono::milliseconds(0);
+    return state;
+}
+
+bool HTTPRateLimitingClient::parse_retry_after(boost::string_view value, std::chrono::seconds &delay) {
+    std::string str(value.data(), value.size());
+    if (value.find_first_not_of("0123456789") == boost::string_view::npos) {
+        delay = std::chrono::seconds(strtol(str.c_str(), NULL, 10));
+        return true;
+    }
+
+    // e.g. Fri, 31 Dec 1999 23:59:59 GMT
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    if (!strptime(str.c_str(), "%a, %d %b %Y %H:%M:%S", &tm))
+        return false;
+
+    delay = std::chrono::seconds((long)std::max(difftime(timegm(&tm), time(NULL)), 0.0));
+    return true;
+}
+
+#endif // _RATELIMIT_HPP_
@@ -0,0 +1,331 @@
+#ifndef _RESOLVERCACHE_HPP_
+#define _RESOLVERCACHE_HPP_
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <map>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+struct ResolverStats {
+    /** Lookups answered from a fresh cache entry. */
+    uint64_t nHits;
+    /** Lookups answered from a cached failure. */
+    uint64_t nNegativeHits;
+    /** Lookups which had to block on the system resolver. */
+    uint64_t nMisses;
+    /** Background refreshes started for entries close to expiry. */
+    uint64_t nRefreshes;
+};
+
+/** Called with the result of HTTPResolverCache::AsyncResolve. */
+typedef boost::function<void(const boost::system::error_code&, const std::vector<boost::asio::ip::tcp::endpoint>&)> ResolveHandler;
+
+/** Process wide cache of resolved endpoints keyed by (server, port).
+ *
+ * Successful lookups are kept for nTTL seconds and failures for nNegativeTTL
+ * seconds. A lookup which lands within nRefreshAhead seconds of expiry is
+ * still answered from the cache but also kicks off an asynchronous refresh on
+ * a background thread, so hosts in regular use never block on getaddrinfo once
+ * they have been resolved the first time. A refresh which fails isn't tried
+ * again for nNegativeTTL seconds. Asynchronous lookups which miss the cache
+ * are resolved on the same background threads, a few of them so that one slow
+ * name server doesn't hold up lookups of every other host. */
+class HTTPResolverCache {
+    public:
+        HTTPResolverCache(unsigned int nTTLIn = 60, unsigned int nNegativeTTLIn = 5, unsigned int nRefreshAheadIn = 10) {
+            SetTTL(nTTLIn, nNegativeTTLIn, nRefreshAheadIn);
+            stats = ResolverStats();
+        }
+
+        ~HTTPResolverCache() {
+            if (!work)
+                return;
+
+            work.reset();
+            io_service.stop();
+            threads.join_all();
+        }
+
+        /** The cache shared by every connection in the process. */
+        static HTTPResolverCache &Global() {
+            static HTTPResolverCache cache;
+            return cache;
+        }
+
+        /** Look up server:port, from the cache when possible. Returns false
+         * with ec set when the name can't be resolved, or with timed_out when
+         * nTimeout milliseconds (if not 0) pass without an answer. */
+        bool Resolve(const std::string &/*server*/, const std::string &/*port*/, std::vector<boost::asio::ip::tcp::endpoint> &/*endpoints*/, boost::system::error_code &/*ec*/, unsigned int nTimeout = 0);
+        /** Non-blocking Resolve, the handler is posted to target either
+         * straight away from the cache or once the background lookup is done. */
+        void AsyncResolve(boost::asio::io_service &/*target*/, const std::string &/*server*/, const std::string &/*port*/, ResolveHandler /*handler*/);
+
+        /** Change how long results are kept, affects entries stored from now on. */
+        void SetTTL(unsigned int nTTLIn, unsigned int nNegativeTTLIn, unsigned int nRefreshAheadIn) {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            nTTL = std::chrono::seconds(nTTLIn);
+            nNegativeTTL = std::chrono::seconds(nNegativeTTLIn);
+            nRefreshAhead = std::chrono::seconds(nRefreshAheadIn < nTTLIn ? nRefreshAheadIn : 0);
+        }
+
+        /** Remember the endpoint a connection to a host was last made on, it
+         * comes first in the endpoints for the host from now on. */
+        void Prefer(const std::string &server, const std::string &port, const boost::asio::ip::tcp::endpoint &endpoint) {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            std::map<HostKey, Entry>::iterator it = entries.find(HostKey(server, port));
+            if (it == entries.end())
+                return;
+
+            it->second.preferred = endpoint;
+            promote(it->second);
+        }
+
+        /** Drop the entry for a host, e.g. after every endpoint failed to connect. */
+        void Invalidate(const std::string &server, const std::string &port) {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            entries.erase(HostKey(server, port));
+        }
+
+        void Clear() {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            entries.clear();
+        }
+
+        ResolverStats GetStats() {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            return stats;
+        }
+
+    private:
+        typedef std::pair<std::string, std::string> HostKey;
+        typedef boost::function<void(const boost::system::error_code&, boost::asio::ip::tcp::resolver::iterator)> LookupHandler;
+
+        /* Background lookups which can be running at once. */
+        enum { LOOKUP_THREADS = 4 };
+
+        struct Entry {
+            Entry() : fRefreshing(false) {}
+
+            std::vector<boost::asio::ip::tcp::endpoint> endpoints;
+            /** Set for a cached failure. */
+            boost::system::error_code ec;
+            std::chrono::steady_clock::time_point expires;
+            bool fRefreshing;
+            /** No refresh is started before then, after one has failed. */
+            std::chrono::steady_clock::time_point retry;
+            /** Where the last connection was made, kept across refreshes. */
+            boost::asio::ip::tcp::endpoint preferred;
+        };
+
+        static void promote(Entry &entry) {
+            std::vector<boost::asio::ip::tcp::endpoint>::iterator it = std::find(entry.endpoints.begin(), entry.endpoints.end(), entry.preferred);
+            if (it != entry.endpoints.end())
+                std::rotate(entry.endpoints.begin(), it, it + 1);
+        }
+
+        void store(const HostKey &key, boost::system::error_code ec, boost::asio::ip::tcp::resolver::iterator it) {
+            Entry &entry = entries[key];
+            entry.endpoints.clear();
+            for (boost::asio::ip::tcp::resolver::iterator end; it != end; ++it)
+                entry.endpoints.push_back(it->endpoint());
+
+            if (!ec && entry.endpoints.empty())
+                ec = boost::asio::error::host_not_found;
+            promote(entry);
+
+            entry.ec = ec;
+            entry.expires = std::chrono::steady_clock::now() + (ec ? nNegativeTTL : nTTL);
+            entry.fRefreshing = false;
+            entry.retry = std::chrono::steady_clock::time_point();
+        }
+
+        bool lookup(const HostKey &/*key*/, std::vector<boost::asio::ip::tcp::endpoint> &/*endpoints*/, boost::system::error_code &/*ec*/);
+        void start_lookup(const HostKey &/*key*/, LookupHandler /*handler*/);
+        void run_lookup(HostKey key, LookupHandler handler);
+        void start_refresh(const HostKey &/*key*/);
+        void handle_resolve(HostKey key, const boost::system::error_code &ec, boost::asio::ip::tcp::resolver::iterator it, boost::asio::io_service *target, boost::shared_ptr<boost::asio::io_service::work> work, ResolveHandler handler);
+        void handle_refresh(HostKey key, const boost::system::error_code &ec, boost::asio::ip::tcp::resolver::iterator it);
+        void handle_wait(HostKey key, const boost::system::error_code &ec, boost::asio::ip::tcp::resolver::iterator it, boost::shared_ptr<std::promise<void> > done);
+
+        boost::mutex mutex;
+        std::map<HostKey, Entry> entries;
+        std::chrono::steady_clock::duration nTTL;
+        std::chrono::steady_clock::duration nNegativeTTL;
+        std::chrono::steady_clock::duration nRefreshAhead;
+        ResolverStats stats;
+
+        /* Background lookups are blocking calls run on their own io_service
+         * by LOOKUP_THREADS threads, started the first time one is needed. */
+        boost::asio::io_service io_service;
+        boost::scoped_ptr<boost::asio::io_service::work> work;
+        boost::thread_group threads;
+};
+
+/* Called with the mutex held, returns false on a miss. */
+bool HTTPResolverCache::lookup(const HostKey &key, std::vector<boost::asio::ip::tcp::endpoint> &endpoints, boost::system::error_code &ec) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::map<HostKey, Entry>::iterator it = entries.find(key);
+    if (it == entries.end() || now >= it->second.expires) {
+        stats.nMisses++;
+        return false;
+    }
+
+    Entry &entry = it->second;
+    if (entry.ec) {
+        stats.nNegativeHits++;
+        ec = entry.ec;
+        return true;
+    }
+
+    if (!entry.fRefreshing && now >= entry.expires - nRefreshAhead && now >= entry.retry)
+        start_refresh(key);
+
+    stats.nHits++;
+    endpoints = entry.endpoints;
+    ec = boost::system::error_code();
+    return true;
+}
+
+bool HTTPResolverCache::Resolve(const std::string &server, const std::string &port, std::vector<boost::asio::ip::tcp::endpoint> &endpoints, boost::system::error_code &ec, unsigned int nTimeout) {
+    HostKey key(server, port);
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        if (lookup(key, endpoints, ec))
+            return !ec;
+    }
+
+    /* getaddrinfo can't be interrupted, so to give up on it in time the
+     * lookup runs on the background thread while we wait. It still lands in
+     * the cache if it finishes after we have gone. */
+    if (nTimeout) {
+        boost::shared_ptr<std::promise<void> > done = boost::make_shared<std::promise<void> >();
+        std::future<void> finished = done->get_future();
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            start_lookup(key, boost::bind(&HTTPResolverCache::handle_wait, this, key, _1, _2, done));
+        }
+
+        if (finished.wait_for(std::chrono::milliseconds(nTimeout)) != std::future_status::ready) {
+            ec = boost::asio::error::timed_out;
+            return false;
+        }
+
+        boost::lock_guard<boost::mutex> lock(mutex);
+        // Invalidated since the lookup landed, so there is no answer to give.
+        std::map<HostKey, Entry>::iterator it = entries.find(key);
+        if (it == entries.end()) {
+            ec = boost::asio::error::try_again;
+            return false;
+        }
+
+        ec = it->second.ec;
+        endpoints = it->second.endpoints;
+
+        return !ec;
+    }
+
+    boost::asio::io_service resolver_service;
+    boost::asio::ip::tcp::resolver blocking_resolver(resolver_service);
+    boost::asio::ip::tcp::resolver::query query(server, port);
+    boost::asio::ip::tcp::resolver::iterator result = blocking_resolver.resolve(query, ec);
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    store(key, ec, result);
+    Entry &entry = entries[key];
+    ec = entry.ec;
+    endpoints = entry.endpoints;
+
+    return !ec;
+}
+
+void HTTPResolverCache::AsyncResolve(boost::asio::io_service &target, const std::string &server, const std::string &port, ResolveHandler handler) {
+    HostKey key(server, port);
+    std::vector<boost::asio::ip::tcp::endpoint> endpoints;
+    boost::system::error_code ec;
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (lookup(key, endpoints, ec)) {
+        target.post(boost::bind(handler, ec, endpoints));
+        return;
+    }
+
+    /* The lookup runs on our own thread, so keep target from running out of
+     * work (and its run() returning) before the handler is posted back. */
+    boost::shared_ptr<boost::asio::io_service::work> work(new boost::asio::io_service::work(target));
+    start_lookup(key, boost::bind(&HTTPResolverCache::handle_resolve, this, key, _1, _2, &target, work, handler));
+}
+
+/* Called with the mutex held. */
+void HTTPResolverCache::start_lookup(const HostKey &key, LookupHandler handler) {
+    if (!work) {
+        work.reset(new boost::asio::io_service::work(io_service));
+        for (int i = 0; i < LOOKUP_THREADS; i++)
+            threads.create_thread(boost::bind(&boost::asio::io_service::run, &io_service));
+    }
+
+    boost::asio::post(io_service, boost::bind(&HTTPResolverCache::run_lookup, this, key, handler));
+}
+
+/* Runs on one of the lookup threads, tying it up until getaddrinfo returns
+ * while the others carry on. asio's own async_resolve would queue every
+ * lookup behind a single thread. */
+void HTTPResolverCache::run_lookup(HostKey key, LookupHandler handler) {
+    boost::asio::ip::tcp::resolver blocking_resolver(io_service);
+    boost::asio::ip::tcp::resolver::query query(key.first, key.second);
+    boost::system::error_code ec;
+    boost::asio::ip::tcp::resolver::iterator it = blocking_resolver.resolve(query, ec);
+    handler(ec, it);
+}
+
+/* Called with the mutex held. */
+void HTTPResolverCache::start_refresh(const HostKey &key) {
+    entries[key].fRefreshing = true;
+    stats.nRefreshes++;
+
+    start_lookup(key, boost::bind(&HTTPResolverCache::handle_refresh, this, key, _1, _2));
+}
+
+void HTTPResolverCache::handle_resolve(HostKey key, const boost::system::error_code &ec, boost::asio::ip::tcp::resolver::iterator it, boost::asio::io_service *target, boost::shared_ptr<boost::asio::io_service::work> /*work*/, ResolveHandler handler) {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    store(key, ec, it);
+    Entry &entry = entries[key];
+    target->post(boost::bind(handler, entry.ec, entry.endpoints));
+}
+
+void HTTPResolverCache::handle_wait(HostKey key, const boost::system::error_code &ec, boost::asio::ip::tcp::resolver::iterator it, boost::shared_ptr<std::promise<void> > done) {
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        store(key, ec, it);
+    }
+
+    done->set_value();
+}
+
+void HTTPResolverCache::handle_refresh(HostKey key, const boost::system::error_code &ec, boost::asio::ip::tcp::resolver::iterator it) {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (ec) {
+        /* Keep serving what we have until it expires, without going back to
+         * a failing resolver on every lookup meanwhile. */
+        std::map<HostKey, Entry>::iterator entry = entries.find(key);
+        if (entry != entries.end()) {
+            entry->second.fRefreshing = false;
+            entry->second.retry = std::chrono::steady_clock::now() + nNegativeTTL;
+        }
+
+        return;
+    }
+
+    store(key, ec, it);
+}
+
+#endif // _RESOLVERCACHE_HPP_
@@ -0,0 +1,586 @@
+#ifndef _RESPONSECACHE_HPP_
+#define _RESPONSECACHE_HPP_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <list>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <asyncclient.hpp>
+#include <diskcache.hpp>
+
+/** The Cache-Control directives a private cache acts on. */
+struct HTTPCacheControl {
+    HTTPCacheControl() : fNoStore(false), fNoCache(false), nMaxAge(-1) {}
+
+    static HTTPCacheControl Parse(boost::string_view /*value*/);
+
+    bool fNoStore;
+    /** Stored, but has to be revalidated every time. */
+    bool fNoCache;
+    /** Seconds the response stays fresh for, -1 when not given. */
+    long nMaxAge;
+};
+
+/** A response kept for reuse, along with what's needed to tell whether it is
+ * still fresh and to ask the server whether it is still current. Shared, and
+ * never modified once stored. */
+struct HTTPCacheEntry {
+    /** Check if the entry can answer request, i.e. the request carries the
+     * same value for every header the response varies on. */
+    bool Matches(const HTTPRequest &request) const {
+        for (std::size_t i = 0; i < vary.size(); i++) {
+            if (request.GetHeader(vary[i].first) != vary[i].second)
+                return false;
+        }
+
+        return true;
+    }
+
+    /** Shared so a revalidated entry can get a new lifetime without copying
+     * the body. */
+    boost::shared_ptr<const HTTPResponse> response;
+    /** The validators the response came with, sent back as If-None-Match
+     * and If-Modified-Since. */
+    std::string strETag;
+    std::string strLastModified;
+    /** Until when the response can be used without asking the server. */
+    std::chrono::steady_clock::time_point expires;
+    /** The request headers named by Vary, with the values the response was
+     * for. */
+    std::vector<std::pair<std::string, std::string> > vary;
+    /** Roughly how much memory the entry holds, parsed JSON included. */
+    std::size_t nSize;
+};
+
+struct HTTPCacheStats {
+    double HitRatio() const {
+        return nLookups ? (double)(nHits + nRevalidated) / nLookups : 0;
+    }
+
+    /** Requests a cached response was looked up for. */
+    uint64_t nLookups;
+    /** Requests answered straight from the cache while fresh. */
+    uint64_t nHits;
+    /** Requests answered from the cache after a 304. */
+    uint64_t nRevalidated;
+    /** Responses stored. */
+    uint64_t nStored;
+    /** Entries read back from the disk cache after missing in memory. */
+    uint64_t nLoaded;
+    uint64_t nEvictions;
+    uint64_t nEntries;
+    /** Approximate memory held by the entries. */
+    uint64_t nBytes;
+};
+
+/** Responses to GET requests, keyed by scheme, host and target, holding
+ * roughly nMaxBytes at most and dropping the least recently used past that.
+ *
+ * Keys are spread over shards which each have their own lock, LRU list and
+ * share of the memory, so threads looking up different resources rarely
+ * wait on each other. A response bigger than a shard's share isn't kept.
+ *
+ * Given an HTTPDiskCache, everything stored is also written through to it and
+ * anything missing from memory is looked for there, so entries outlive the
+ * process and are shared with every other process using the same file. */
+class HTTPResponseCache {
+    public:
+        HTTPResponseCache(std::size_t nMaxBytes = 64 << 20, unsigned int nShardsIn = 16, HTTPDiskCache *diskIn = NULL);
+
+        static std::string Key(const std::string &/*server*/, const std::string &/*port*/, bool fUseSSL, boost::string_view /*target*/);
+
+        boost::shared_ptr<const HTTPCacheEntry> Get(const std::string &/*key*/);
+        void Put(const std::string &/*key*/, boost::shared_ptr<const HTTPCacheEntry> /*entry*/);
+        void Erase(const std::string &/*key*/);
+
+        /** Counters summed over every shard. */
+        HTTPCacheStats GetStats();
+
+    private:
+        friend class HTTPCachingClient;
+
+        typedef std::list<std::pair<std::string, boost::shared_ptr<const HTTPCacheEntry> > > LRUList;
+
+        /* Add an entry to memory only. */
+        void insert(const std::string &/*key*/, boost::shared_ptr<const HTTPCacheEntry> /*entry*/);
+        boost::shared_ptr<const HTTPCacheEntry> load(const std::string &/*key*/);
+
+        static std::string encode(const HTTPCacheEntry &/*entry*/);
+        static boost::shared_ptr<HTTPCacheEntry> decode(const std::string &/*key*/, boost::string_view /*data*/);
+
+        struct Shard {
+            Shard() : nBytes(0), stats(HTTPCacheStats()) {}
+
+            boost::mutex mutex;
+            /** Most recently used first. */
+            LRUList lru;
+            boost::unordered_map<std::string, LRUList::iterator> entries;
+            std::size_t nBytes;
+            HTTPCacheStats stats;
+        };
+
+        Shard &shard(const std::string &key) {
+            return shards[boost::hash<std::string>()(key) % nShards];
+        }
+
+        void count_hit(const std::string &key, bool fRevalidated) {
+            Shard &s = shard(key);
+            boost::lock_guard<boost::mutex> lock(s.mutex);
+            (fRevalidated ? s.stats.nRevalidated : s.stats.nHits)++;
+        }
+
+        unsigned int nShards;
+        std::size_t nShardBytes;
+        boost::scoped_array<Shard> shards;
+        HTTPDiskCache *disk;
+};
+
+HTTPCacheControl HTTPCacheControl::Parse(boost::string_view value) {
+    HTTPCacheControl cc;
+    while (!value.empty()) {
+        std::size_t nEnd = std::min(value.find(','), value.size());
+        boost::string_view directive = value.substr(0, nEnd);
+        value.remove_prefix(std::min(nEnd + 1, value.size()));
+
+        while (!directive.empty() && (directive.front() == ' ' || directive.front() == '\t'))
+            directive.remove_prefix(1);
+        while (!directive.empty() && (directive.back() == ' ' || directive.back() == '\t'))
+            directive.remove_suffix(1);
+
+        if (boost::algorithm::iequals(directive, "no-store")) {
+            cc.fNoStore = true;
+        } else if (boost::algorithm::iequals(directive, "no-cache")) {
+            cc.fNoCache = true;
+        } else if (directive.size() > 8 && boost::algorithm::iequals(directive.substr(0, 8), "max-age=")) {
+            std::string seconds(directive.data() + 8, directive.size() - 8);
+            cc.nMaxAge = std::max(0L, strtol(seconds.c_str(), NULL, 10));
+        }
+    }
+
+    return cc;
+}
+
+namespace {
+    /* Heap memory a string holds beyond its own size, none while it fits
+     * the small string buffer. */
+    std::size_t heap_size(const std::string &str) {
+        return str.capacity() > 15 ? str.capacity() + 1 : 0;
+    }
+
+    /* Approximate heap memory under a parsed JSON value. */
+    std::size_t json_size(const json_spirit::Value &value) {
+        std::size_t nSize = 0;
+        switch (value.type()) {
+            case json_spirit::obj_type: {
+                const json_spirit::Object &obj = value.get_obj();
+                nSize = sizeof(obj) + obj.capacity() * sizeof(json_spirit::Pair);
+                for (std::size_t i = 0; i < obj.size(); i++)
+                    nSize += heap_size(obj[i].name_) + json_size(obj[i].value_);
+                break;
+            }
+            case json_spirit::array_type: {
+                const json_spirit::Array &array = value.get_array();
+                nSize = sizeof(array) + array.capacity() * sizeof(json_spirit::Value);
+                for (std::size_t i = 0; i < array.size(); i++)
+                    nSize += json_size(array[i]);
+                break;
+            }
+            case json_spirit::str_type:
+                nSize = heap_size(value.get_str());
+                break;
+            default:
+                break;
+        }
+
+        return nSize;
+    }
+
+    /* Fill in what an entry for key holding response is left needing. JSON
+     * is parsed once here rather than on every hit, the value is shared by
+     * everything the entry is handed to. */
+    void finish_entry(const std::string &key, HTTPCacheEntry &entry, boost::shared_ptr<HTTPResponse> response) {
+        if (boost::algorithm::icontains(response->GetHeader(HEADER_CONTENT_TYPE), "json"))
+            response->ParseJSON();
+
+        entry.nSize = sizeof(HTTPCacheEntry) + sizeof(HTTPResponse) + key.size() + response->headers.size() + response->body.size() + response->index.Count() * 16;
+        if (response->json)
+            entry.nSize += sizeof(json_spirit::Value) + json_size(*response->json);
+        entry.response = response;
+    }
+
+    /* The disk cache format: native integers and length prefixed strings,
+     * it is only shared between processes on the same machine. */
+    void put_u64(std::string &out, uint64_t n) {
+        out.append((const char*)&n, sizeof(n));
+    }
+
+    void put_str(std::string &out, boost::string_view str) {
+        put_u64(out, str.size());
+        out.append(str.data(), str.size());
+    }
+
+    bool get_u64(boost::string_view &in, uint64_t &n) {
+        if (in.size() < sizeof(n))
+            return false;
+
+        memcpy(&n, in.data(), sizeof(n));
+        in.remove_prefix(sizeof(n));
+        return true;
+    }
+
+    bool get_str(boost::string_view &in, std::string &str) {
+        uint64_t n;
+        if (!get_u64(in, n) || n > in.size())
+            return false;
+
+        str.assign(in.data(), n);
+        in.remove_prefix(n);
+        return true;
+    }
+} // namespace
+
+HTTPResponseCache::HTTPResponseCache(std::size_t nMaxBytes, unsigned int nShardsIn, HTTPDiskCache *diskIn) : disk(diskIn) {
+    nShards = nShardsIn > 0 ? nShardsIn : 1;
+    nShardBytes = nMaxBytes / nShards;
+    shards.reset(new Shard[nShards]);
+}
+
+std::string HTTPResponseCache::Key(const std::string &server, const std::string &port, bool fUseSSL, boost::string_view target) {
+    std::string key;
+    key.reserve(server.size() + port.size() + target.size() + 10);
+    key.append(fUseSSL ? "https://" : "http://");
+    key.append(server);
+    key.append(":", 1);
+    key.append(port);
+    key.append(target.data(), target.size());
+
+    return key;
+}
+
+boost::shared_ptr<const HTTPCacheEntry> HTTPResponseCache::Get(const std::string &key) {
+    Shard &s = shard(key);
+    boost::unique_lock<boost::mutex> lock(s.mutex);
+    s.stats.nLookups++;
+    boost::unordered_map<std::string, LRUList::iterator>::iterator it = s.entries.find(key);
+    if (it != s.entries.end()) {
+        s.lru.splice(s.lru.begin(), s.lru, it->second);
+        return it->second->second;
+    }
+
+    if (!disk)
+        return boost::shared_ptr<const HTTPCacheEntry>();
+
+    // Not under the shard's lock, reading and parsing the entry takes a while.
+    lock.unlock();
+    return load(key);
+}
+
+boost::shared_ptr<const HTTPCacheEntry> HTTPResponseCache::load(const std::string &key) {
+    std::string data;
+    if (!disk->Get(key, data))
+        return boost::shared_ptr<const HTTPCacheEntry>();
+
+    boost::shared_ptr<HTTPCacheEntry> entry = decode(key, data);
+    if (!entry)
+        return entry;
+
+    insert(key, entry);
+    Shard &s = shard(key);
+    boost::lock_guard<boost::mutex> lock(s.mutex);
+    s.stats.nLoaded++;
+    return entry;
+}
+
+void HTTPResponseCache::Put(const std::string &key, boost::shared_ptr<const HTTPCacheEntry> entry) {
+    if (disk)
+        disk->Put(key, encode(*entry));
+
+    insert(key, entry);
+    Shard &s = shard(key);
+    boost::lock_guard<boost::mutex> lock(s.mutex);
+    s.stats.nStored++;
+}
+
+void HTTPResponseCache::insert(const std::string &key, boost::shared_ptr<const HTTPCacheEntry> entry) {
+    // Anything too big to fit would only push everything else out.
+    if (entry->nSize > nShardBytes)
+        return;
+
+    Shard &s = shard(key);
+    // Whatever is dropped is freed after the lock is released.
+    LRUList dropped;
+    boost::lock_guard<boost::mutex> lock(s.mutex);
+    boost::unordered_map<std::string, LRUList::iterator>::iterator it = s.entries.find(key);
+    if (it != s.entries.end()) {
+        s.nBytes -= it->second->second->nSize;
+        it->second->second.swap(entry);
+        s.nBytes += it->second->second->nSize;
+        s.lru.splice(s.lru.begin(), s.lru, it->second);
+        dropped.push_back(std::make_pair(std::string(), entry));
+    } else {
+        s.lru.push_front(std::make_pair(key, entry));
+        s.entries[key] = s.lru.begin();
+        s.nBytes += entry->nSize;
+    }
+
+    while (s.nBytes > nShardBytes) {
+        s.nBytes -= s.lru.back().second->nSize;
+        s.entries.erase(s.lru.back().first);
+        dropped.splice(dropped.begin(), s.lru, --s.lru.end());
+        s.stats.nEvictions++;
+    }
+}
+
+void HTTPResponseCache::Erase(const std::string &key) {
+    if (disk)
+        disk->Erase(key);
+
+    Shard &s = shard(key);
+    LRUList dropped;
+    boost::lock_guard<boost::mutex> lock(s.mutex);
+    boost::unordered_map<std::string, LRUList::iterator>::iterator it = s.entries.find(key);
+    if (it == s.entries.end())
+        return;
+
+    s.nBytes -= it->second->second->nSize;
+    dropped.splice(dropped.begin(), s.lru, it->second);
+    s.entries.erase(it);
+}
+
+HTTPCacheStats HTTPResponseCache::GetStats() {
+    HTTPCacheStats total = HTTPCacheStats();
+    for (unsigned int i = 0; i < nShards; i++) {
+        Shard &s = shards[i];
+        boost::lock_guard<boost::mutex> lock(s.mutex);
+        total.nLookups += s.stats.nLookups;
+        total.nHits += s.stats.nHits;
+        total.nRevalidated += s.stats.nRevalidated;
+        total.nStored += s.stats.nStored;
+        total.nLoaded += s.stats.nLoaded;
+        total.nEvictions += s.stats.nEvictions;
+        total.nEntries += s.entries.size();
+        total.nBytes += s.nBytes;
+    }
+
+    return total;
+}
+
+std::string HTTPResponseCache::encode(const HTTPCacheEntry &entry) {
+    const HTTPResponse &response = *entry.response;
+    std::string out;
+    out.reserve(response.headers.size() + response.body.size() + 256);
+
+    // The time left is only meaningful to another process as a wall clock time.
+    std::chrono::system_clock::time_point expires = std::chrono::system_clock::now() + std::chrono::duration_cast<std::chrono::system_clock::duration>(entry.expires - std::chrono::steady_clock::now());
+    put_u64(out, std::chrono::duration_cast<std::chrono::milliseconds>(expires.time_since_epoch()).count());
+    put_u64(out, response.nStatus);
+    put_str(out, entry.strETag);
+    put_str(out, entry.strLastModified);
+    put_u64(out, entry.vary.size());
+    for (std::size_t i = 0; i < entry.vary.size(); i++) {
+        put_str(out, entry.vary[i].first);
+        put_str(out, entry.vary[i].second);
+    }
+
+    // The header index goes too, so it needn't be rebuilt.
+    put_str(out, response.headers);
+    put_u64(out, response.index.Count());
+    for (std::size_t i = 0; i < response.index.Count(); i++) {
+        boost::string_view name = response.index.GetName(response.headers, i);
+        boost::string_view value = response.index.GetValue(response.headers, i);
+        put_u64(out, name.data() - response.headers.data());
+        put_u64(out, name.size());
+        put_u64(out, value.data() - response.headers.data());
+        put_u64(out, value.size());
+    }
+    put_str(out, response.body);
+
+    return out;
+}
+
+boost::shared_ptr<HTTPCacheEntry> HTTPResponseCache::decode(const std::string &key, boost::string_view data) {
+    boost::shared_ptr<HTTPCacheEntry> entry = boost::make_shared<HTTPCacheEntry>();
+    boost::shared_ptr<HTTPResponse> response = boost::make_shared<HTTPResponse>();
+    uint64_t nExpires, nStatus, nVary, nFields;
+    if (!get_u64(data, nExpires) || !get_u64(data, nStatus) || !get_str(data, entry->strETag) || !get_str(data, entry->strLastModified) || !get_u64(data, nVary))
+        return boost::shared_ptr<HTTPCacheEntry>();
+
+    for (uint64_t i = 0; i < nVary; i++) {
+        std::pair<std::string, std::string> value;
+        if (!get_str(data, value.first) || !get_str(data, value.second))
+            return boost::shared_ptr<HTTPCacheEntry>();
+        entry->vary.push_back(value);
+    }
+
+    if (!get_str(data, response->headers) || !get_u64(data, nFields))
+        return boost::shared_ptr<HTTPCacheEntry>();
+
+    for (uint64_t i = 0; i < nFields; i++) {
+        uint64_t field[4];
+        for (int n = 0; n < 4; n++) {
+            if (!get_u64(data, field[n]))
+                return boost::shared_ptr<HTTPCacheEntry>();
+        }
+
+        if (field[0] + field[1] > response->headers.size() || field[2] + field[3] > response->headers.size())
+            return boost::shared_ptr<HTTPCacheEntry>();
+        response->index.Add(response->headers, field[0], field[1], field[2], field[3]);
+    }
+
+    if (!get_str(data, response->body))
+        return boost::shared_ptr<HTTPCacheEntry>();
+
+    response->nStatus = nStatus;
+    std::chrono::system_clock::time_point expires = std::chrono::system_clock::time_point(std::chrono::milliseconds(nExpires));
+    entry->expires = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(expires - std::chrono::system_clock::now());
+    finish_entry(key, *entry, response);
+
+    return entry;
+}
+
+/** Answers GET requests from an HTTPResponseCache where it can, the way a
+ * private HTTP cache does:
+ *
+ *  - a response is kept if it came with an ETag or Last-Modified, or a
+ *    max-age; never with Cache-Control: no-store or Vary: *;
+ *  - while it is fresh (max-age less its Age) it is handed straight back;
+ *  - once stale, or always with no-cache, the request is sent with
+ *    If-None-Match and If-Modified-Since, and a 304 Not Modified hands back
+ *    the stored response, body and all, with a new lifetime;
+ *  - a response with Vary is only used for requests with the same values
+ *    for the headers it names, one variant is kept per target.
+ *
+ * Bodies labelled JSON are parsed once when stored and the parsed value is
+ * kept with them, so a hit costs neither a transfer nor a parse. GitHub
+ * doesn't count a 304 against the rate limit either.
+ *
+ * Requests passed in already serialized can't have headers added, so they
+ * are only ever answered from the cache while fresh. */
+class HTTPCachingClient : public HTTPRequester {
+    public:
+        HTTPCachingClient(HTTPRequester &innerIn, HTTPResponseCache &cacheIn) : inner(innerIn), cache(cacheIn) {}
+
+        void AsyncRequest(const std::string &/*server*/, const std::string &/*port*/, const HTTPRequest &/*request*/, bool fUseSSL, HTTPResponseHandler /*handler*/);
+
+    private:
+        void handle_response(const std::string &/*key*/, const HTTPRequest &/*request*/, boost::shared_ptr<const HTTPCacheEntry> /*entry*/, HTTPResponseHandler /*handler*/, const HTTPResponse &/*response*/);
+
+        /* When a response stops being fresh, going by its Cache-Control and
+         * Age. */
+        static std::chrono::steady_clock::time_point expiry(const HTTPResponse &/*response*/, const HTTPCacheControl &/*cc*/);
+
+        HTTPRequester &inner;
+        HTTPResponseCache &cache;
+};
+
+void HTTPCachingClient::AsyncRequest(const std::string &server, const std::string &port, const HTTPRequest &request, bool fUseSSL, HTTPResponseHandler handler) {
+    // A streamed body never reaches the response, so there's nothing to keep.
+    if (request.GetMethod() != "GET" || request.GetBodySink()) {
+        inner.AsyncRequest(server, port, request, fUseSSL, handler);
+        return;
+    }
+
+    std::string key = HTTPResponseCache::Key(server, port, fUseSSL, request.GetTarget());
+    boost::shared_ptr<const HTTPCacheEntry> entry = cache.Get(key);
+    if (entry && !entry->Matches(request))
+        entry.reset();
+
+    if (entry && std::chrono::steady_clock::now() < entry->expires) {
+        cache.count_hit(key, false);
+        handler(*entry->response);
+        return;
+    }
+
+    if (!entry || request.IsSerialized() || (entry->strETag.empty() && entry->strLastModified.empty())) {
+        inner.AsyncRequest(server, port, request, fUseSSL, boost::bind(&HTTPCachingClient::handle_response, this, key, request, boost::shared_ptr<const HTTPCacheEntry>(), handler, _1));
+        return;
+    }
+
+    HTTPRequest conditional(request);
+    if (!entry->strETag.empty())
+        conditional.AddHeader("If-None-Match", entry->strETag);
+    if (!entry->strLastModified.empty())
+        conditional.AddHeader("If-Modified-Since", entry->strLastModified);
+
+    inner.AsyncRequest(server, port, conditional, fUseSSL, boost::bind(&HTTPCachingClient::handle_response, this, key, request, entry, handler, _1));
+}
+
+std::chrono::steady_clock::time_point HTTPCachingClient::expiry(const HTTPResponse &response, const HTTPCacheControl &cc) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (cc.fNoCache || cc.nMaxAge <= 0)
+        return now;
+
+    // Time the response already spent in caches on the way counts against it.
+    boost::string_view age = response.GetHeader(HEADER_AGE);
+    long nAge = age.empty() ? 0 : strtol(std::string(age.data(), age.size()).c_str(), NULL, 10);
+    if (nAge >= cc.nMaxAge)
+        return now;
+
+    return now + std::chrono::seconds(cc.nMaxAge - std::max(0L, nAge));
+}
+
+void HTTPCachingClient::handle_response(const std::string &key, const HTTPRequest &request, boost::shared_ptr<const HTTPCacheEntry> entry, HTTPResponseHandler handler, const HTTPResponse &response) {
+    if (!response.ec && response.nStatus == 304 && entry) {
+        // Same response, but the 304 says how long it is good for now.
+        boost::shared_ptr<HTTPCacheEntry> renewed = boost::make_shared<HTTPCacheEntry>(*entry);
+        boost::string_view cacheControl = response.GetHeader(HEADER_CACHE_CONTROL);
+        renewed->expires = expiry(response, cacheControl.empty() ? HTTPCacheControl::Parse(entry->response->GetHeader(HEADER_CACHE_CONTROL)) : HTTPCacheControl::Parse(cacheControl));
+        cache.Put(key, renewed);
+        cache.count_hit(key, true);
+        handler(*entry->response);
+        return;
+    }
+
+    if (response.ec || response.nStatus != 200) {
+        handler(response);
+        return;
+    }
+
+    HTTPCacheControl cc = HTTPCacheControl::Parse(response.GetHeader(HEADER_CACHE_CONTROL));
+    boost::string_view etag = response.GetHeader(HEADER_ETAG);
+    boost::string_view lastModified = response.GetHeader(HEADER_LAST_MODIFIED);
+    boost::string_view vary = response.GetHeader(HEADER_VARY);
+    if (cc.fNoStore || vary == "*" || (etag.empty() && lastModified.empty() && cc.nMaxAge <= 0)) {
+        // Nothing worth keeping, and whatever was kept is out of date.
+        cache.Erase(key);
+        handler(response);
+        return;
+    }
+
+    boost::shared_ptr<HTTPCacheEntry> fresh = boost::make_shared<HTTPCacheEntry>();
+    boost::shared_ptr<HTTPResponse> stored = boost::make_shared<HTTPResponse>(response);
+    fresh->strETag.assign(etag.data(), etag.size());
+    fresh->strLastModified.assign(lastModified.data(), lastModified.size());
+    fresh->expires = expiry(response, cc);
+    while (!vary.empty()) {
+        std::size_t nEnd = std::min(vary.find(','), vary.size());
+        boost::string_view name = vary.substr(0, nEnd);
+        vary.remove_prefix(std::min(nEnd + 1, vary.size()));
+        while (!name.empty() && name.front() == ' ')
+            name.remove_prefix(1);
+        while (!name.empty() && name.back() == ' ')
+            name.remove_suffix(1);
+        if (name.empty())
+            continue;
+
+        boost::string_view value = request.GetHeader(name);
+        fresh->vary.push_back(std::make_pair(std::string(name.data(), name.size()), std::string(value.data(), value.size())));
+    }
+
+    finish_entry(key, *fresh, stored);
+
+    cache.Put(key, fresh);
+    handler(*stored);
+}
+
+#endif // _RESPONSECACHE_HPP_
@@ -0,0 +1,250 @@
+#ifndef _TLSCONTEXT_HPP_
+#define _TLSCONTEXT_HPP_
+
+#include <map>
+
+#include <boost/asio/ip/address.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+struct TLSOptions {
+    TLSOptions() : nMinVersion(TLS1_2_VERSION), nMaxVersion(0) {}
+
+    /** OpenSSL cipher list for TLS 1.2 and below, library default if empty. */
+    std::string strCipherList;
+    /** TLS 1.3 cipher suites, library default if empty. */
+    std::string strCipherSuites;
+    /** Lowest and highest protocol versions to negotiate (TLS1_2_VERSION etc),
+     * 0 leaves that end of the range up to the library. */
+    int nMinVersion;
+    int nMaxVersion;
+    /** CA bundle file and/or hashed directory, the system default verify
+     * paths are used when both are empty. */
+    std::string strCAFile;
+    std::string strCAPath;
+};
+
+struct TLSStats {
+    /** Handshakes which negotiated a brand new session. */
+    uint64_t nFullHandshakes;
+    /** Handshakes which resumed a cached session. */
+    uint64_t nResumedHandshakes;
+    /** Hosts with a session waiting to be resumed. */
+    uint64_t nCachedSessions;
+};
+
+/** A long lived TLS context shared by every secure connection. The CA store is
+ * only loaded when the context is built (on construction and on an explicit
+ * Reload) rather than for every request.
+ *
+ * Reload builds a complete new ssl::context and swaps it in; connections hold
+ * on to the context they were created with through Get(), so the swap is safe
+ * while other threads are mid request.
+ *
+ * Sessions (or TLS 1.3 tickets) handed out by servers are cached per host and
+ * offered again on the next connection so reconnects can skip a full
+ * handshake. The TLSContext must outlive every connection created from it. */
+class TLSContext {
+    public:
+        TLSContext(const TLSOptions &optionsIn = TLSOptions()) : options(optionsIn) {
+            stats = TLSStats();
+            context = create_context(options);
+            if (!context) // Leave a usable (if unverifiable) context behind.
+                context = boost::make_shared<boost::asio::ssl::context>(boost::asio::ssl::context::sslv23);
+        }
+
+        ~TLSContext() {
+            clear_sessions();
+        }
+
+        /** Grab the current context, safe to call from any thread. */
+        boost::shared_ptr<boost::asio::ssl::context> Get() {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            return context;
+        }
+
+        /** Rebuild the context, reloading the CA store. On failure the current
+         * context is left in place. */
+        bool Reload() {
+            return Reload(GetOptions());
+        }
+        /** Rebuild the context with new options. */
+        bool Reload(const TLSOptions &/*optionsIn*/);
+
+        TLSOptions GetOptions() {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            return options;
+        }
+
+        /** Set SNI on a new connection and offer the session cached for the
+         * host, if any, before it handshakes. */
+        void PrepareSession(SSL */*ssl*/, const std::string &/*server*/, const std::string &/*port*/);
+        /** Count a finished handshake as full or resumed, a failed handshake
+         * drops the cached session so the next attempt starts fresh. */
+        void EndHandshake(SSL */*ssl*/, const boost::system::error_code &ec);
+        /** Forget every cached session. */
+        void ClearSessions() {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            clear_sessions();
+        }
+
+        TLSStats GetStats() {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            stats.nCachedSessions = sessions.size();
+            return stats;
+        }
+
+    private:
+        boost::shared_ptr<boost::asio::ssl::context> create_context(const TLSOptions &/*opts*/);
+
+        void clear_sessions() {
+            for (std::map<std::string, SSL_SESSION*>::iterator it = sessions.begin(); it != sessions.end(); ++it)
+                SSL_SESSION_free(it->second);
+            sessions.clear();
+        }
+
+        /* Back pointer from an SSL_CTX to the TLSContext which owns it. */
+        static int context_index() {
+            static int index = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+            return index;
+        }
+
+        static void free_session_key(void */*parent*/, void *ptr, CRYPTO_EX_DATA */*ad*/, int /*idx*/, long /*argl*/, void */*argp*/) {
+            delete static_cast<std::string*>(ptr);
+        }
+
+        /* Session cache key ("server:port") attached to each SSL object. */
+        static int session_key_index() {
+            static int index = SSL_get_ex_new_index(0, NULL, NULL, NULL, free_session_key);
+            return index;
+        }
+
+        /* OpenSSL hands us every new session here, including TLS 1.3 tickets
+         * which only arrive after the handshake has finished. */
+        static int new_session(SSL */*ssl*/, SSL_SESSION */*session*/);
+
+        boost::mutex mutex;
+        TLSOptions options;
+        boost::shared_ptr<boost::asio::ssl::context> context;
+        std::map<std::string, SSL_SESSION*> sessions;
+        TLSStats stats;
+};
+
+boost::shared_ptr<boost::asio::ssl::context> TLSContext::create_context(const TLSOptions &opts) {
+    boost::shared_ptr<boost::asio::ssl::context> ctx = boost::make_shared<boost::asio::ssl::context>(boost::asio::ssl::context::sslv23);
+    SSL_CTX *native = ctx->native_handle();
+    boost::system::error_code ec;
+
+    ctx->set_options(boost::asio::ssl::context::default_workarounds | boost::asio::ssl::context::no_sslv2 | boost::asio::ssl::context::no_sslv3, ec);
+
+    if (opts.nMinVersion && !SSL_CTX_set_min_proto_version(native, opts.nMinVersion)) {
+        printf("TLSContext::create_context : unsupported minimum protocol version %x\n", opts.nMinVersion);
+        return boost::shared_ptr<boost::asio::ssl::context>();
+    }
+
+    if (opts.nMaxVersion && !SSL_CTX_set_max_proto_version(native, opts.nMaxVersion)) {
+        printf("TLSContext::create_context : unsupported maximum protocol version %x\n", opts.nMaxVersion);
+        return boost::shared_ptr<boost::asio::ssl::context>();
+    }
+
+    if (!opts.strCipherList.empty() && !SSL_CTX_set_cipher_list(native, opts.strCipherList.c_str())) {
+        printf("TLSContext::create_context : invalid cipher list %s\n", opts.strCipherList.c_str());
+        return boost::shared_ptr<boost::asio::ssl::context>();
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    if (!opts.strCipherSuites.empty() && !SSL_CTX_set_ciphersuites(native, opts.strCipherSuites.c_str())) {
+        printf("TLSContext::create_context : invalid cipher suites %s\n", opts.strCipherSuites.c_str());
+        return boost::shared_ptr<boost::asio::ssl::context>();
+    }
+#endif
+
+    SSL_CTX_set_session_cache_mode(native, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(native, &TLSContext::new_session);
+    SSL_CTX_set_ex_data(native, context_index(), this);
+
+    if (opts.strCAFile.empty() && opts.strCAPath.empty())
+        ctx->set_default_verify_paths(ec);
+    else {
+        if (!opts.strCAFile.empty())
+            ctx->load_verify_file(opts.strCAFile, ec);
+        if (!ec && !opts.strCAPath.empty())
+            ctx->add_verify_path(opts.strCAPath, ec);
+    }
+    if (ec) {
+        printf("TLSContext::create_context : error loading CA store %s\n", ec.message().c_str());
+        return boost::shared_ptr<boost::asio::ssl::context>();
+    }
+
+    return ctx;
+}
+
+bool TLSContext::Reload(const TLSOptions &optionsIn) {
+    boost::shared_ptr<boost::asio::ssl::context> ctx = create_context(optionsIn);
+    if (!ctx)
+        return false;
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    options = optionsIn;
+    context.swap(ctx);
+    // Sessions negotiated under the old settings may no longer be acceptable.
+    clear_sessions();
+
+    return true;
+}
+
+void TLSContext::PrepareSession(SSL *ssl, const std::string &server, const std::string &port) {
+    boost::system::error_code ec;
+    boost::asio::ip::address::from_string(server, ec);
+    if (ec) // SNI only carries host names, never address literals.
+        SSL_set_tlsext_host_name(ssl, server.c_str());
+
+    std::string *key = new std::string(server + ":" + port);
+    SSL_set_ex_data(ssl, session_key_index(), key);
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    std::map<std::string, SSL_SESSION*>::iterator it = sessions.find(*key);
+    if (it != sessions.end())
+        SSL_set_session(ssl, it->second);
+}
+
+void TLSContext::EndHandshake(SSL *ssl, const boost::system::error_code &ec) {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (!ec) {
+        if (SSL_session_reused(ssl))
+            stats.nResumedHandshakes++;
+        else
+            stats.nFullHandshakes++;
+
+        return;
+    }
+
+    std::string *key = static_cast<std::string*>(SSL_get_ex_data(ssl, session_key_index()));
+    if (!key)
+        return;
+
+    std::map<std::string, SSL_SESSION*>::iterator it = sessions.find(*key);
+    if (it != sessions.end()) {
+        SSL_SESSION_free(it->second);
+        sessions.erase(it);
+    }
+}
+
+int TLSContext::new_session(SSL *ssl, SSL_SESSION *session) {
+    TLSContext *tls = static_cast<TLSContext*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), context_index()));
+    std::string *key = static_cast<std::string*>(SSL_get_ex_data(ssl, session_key_index()));
+    if (!tls || !key)
+        return 0;
+
+    boost::lock_guard<boost::mutex> lock(tls->mutex);
+    SSL_SESSION *&cached = tls->sessions[*key];
+    if (cached)
+        SSL_SESSION_free(cached);
+    cached = session;
+
+    return 1; // We keep the reference OpenSSL handed us.
+}
+
+#endif // _TLSCONTEXT_HPP_
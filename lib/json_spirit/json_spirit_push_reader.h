@@ -0,0 +1,443 @@
+#ifndef JSON_SPIRIT_PUSH_READER
+#define JSON_SPIRIT_PUSH_READER
+
+//          Copyright John W. Wilkinson 2007 - 2009.
+// Distributed under the MIT License, see accompanying file LICENSE.txt
+
+// json spirit version 4.03
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+#include "json_spirit_reader_template.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <vector>
+
+namespace json_spirit
+{
+    // this class parses a single top level value which arrives in pieces, e.g. off a socket,
+    // without needing the whole text up front; feed it each piece as it arrives, then call
+    // finish once there is no more, the value is built as it goes using the same semantic
+    // actions as the other read functions
+    //
+    //     Push_reader< Value > reader;
+    //     while( more data ) if( !reader.feed( data, len ) ) error;
+    //     if( !reader.finish() ) error;
+    //     Value value = reader.get_value();
+    //
+    template< class Value_type >
+    class Push_reader
+    {
+    public:
+
+        typedef typename Value_type::Config_type Config_type;
+        typedef typename Config_type::String_type String_type;
+        typedef typename String_type::value_type Char_type;
+
+        Push_reader()
+        :   actions_( value_ )
+        ,   state_( value_start )
+        ,   escaped_( false )
+        ,   literal_( 0 )
+        {
+        }
+
+        // parse the next len characters, returns false once the text can't be valid JSON
+        //
+        bool feed( const Char_type* p, size_t len )
+        {
+            for( const Char_type* end = p + len; p != end && state_ != error; )
+            {
+                if( consume( *p ) ) ++p;
+            }
+
+            return state_ != error;
+        }
+
+        // call once all the text has been fed, returns true if it held exactly one value
+        //
+        bool finish()
+        {
+            if( state_ == number ) end_number();
+
+            return state_ == done;
+        }
+
+        bool is_error() const
+        {
+            return state_ == error;
+        }
+
+        // the parsed value, only complete once finish has returned true; the non-const
+        // version lets the value be swapped out rather than copied
+        //
+        const Value_type& get_value() const
+        {
+            return value_;
+        }
+
+        Value_type& get_value()
+        {
+            return value_;
+        }
+
+    private:
+
+        typedef typename String_type::const_iterator Iter_type;
+
+        enum State
+        {
+            value_start,    // expecting a value
+            array_start,    // after '[', expecting a value or ']'
+            object_start,   // after '{', expecting a name or '}'
+            name_start,     // after ',' in an object, expecting a name
+            colon,          // after a name, expecting ':'
+            value_end,      // after a value, expecting ',' or the end of the enclosing array or object
+            string,         // inside a string value
+            name,           // inside a name
+            number,
+            literal,        // inside true, false or null
+            done,           // after the top level value, only white space may follow
+            error
+        };
+
+        Push_reader( const Push_reader& );
+        Push_reader& operator=( const Push_reader& );
+
+        static bool is_space( Char_type c )
+        {
+            return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+        }
+
+        static bool is_number_char( Char_type c )
+        {
+            return ( c >= '0' && c <= '9' ) || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+        }
+
+        // returns false when c has to be looked at again in the new state
+        //
+        bool consume( Char_type c )
+        {
+            switch( state_ )
+            {
+                case string:
+                case name:
+                    token_ += c;
+
+                    if( escaped_ )
+                    {
+                        escaped_ = false;
+                    }
+                    else if( c == '\\' )
+                    {
+                        escaped_ = true;
+                    }
+                    else if( c == '"' )
+                    {
+                        end_string();
+                    }
+                    return true;
+
+                case number:
+                    if( is_number_char( c ) )
+                    {
+                        token_ += c;
+                        return true;
+                    }
+
+                    end_number();
+                    return false;
+
+                case literal:
+                    if( c != literal_[ token_.size() ] )
+                    {
+                        state_ = error;
+                        return true;
+                    }
+
+                    token_ += c;
+
+                    if( literal_[ token_.size() ] == 0 ) end_literal();
+                    return true;
+
+                default:
+                    break;
+            }
+
+            if( is_space( c ) ) return true;
+
+            switch( state_ )
+            {
+                case array_start:
+                    if( c == ']' )
+                    {
+                        end_compound( c );
+                        return true;
+                    }
+                    // Anything else starts the first element.
+                    // fall through
+
+                case value_start:
+                    start_value( c );
+                    return true;
+
+                case object_start:
+                    if( c == '}' )
+                    {
+                        end_compound( c );
+                        return true;
+                    }
+                    // Anything else starts the first name.
+                    // fall through
+
+                case name_start:
+                    if( c != '"' )
+                    {
+                        state_ = error;
+                        return true;
+                    }
+
+                    start_token( name, c );
+                    return true;
+
+                case colon:
+                    state_ = ( c == ':' ) ? value_start : error;
+                    return true;
+
+                case value_end:
+                    if( !stack_.empty() && c == ',' )
+                    {
+                        state_ = ( stack_.back() == '{' ) ? name_start : value_start;
+                    }
+                    else if( !stack_.empty() && ( c == '}' || c == ']' ) && c == ( stack_.back() == '{' ? '}' : ']' ) )
+                    {
+                        end_compound( c );
+                    }
+                    else
+                    {
+                        state_ = error;
+                    }
+                    return true;
+
+                default:
+                    state_ = error;
+                    return true;
+            }
+        }
+
+        void start_value( Char_type c )
+        {
+            switch( c )
+            {
+                case '{':
+                    actions_.begin_obj( c );
+                    stack_.push_back( c );
+                    state_ = object_start;
+                    break;
+
+                case '[':
+                    actions_.begin_array( c );
+                    stack_.push_back( c );
+                    state_ = array_start;
+                    break;
+
+                case '"':
+                    start_token( string, c );
+                    break;
+
+                case 't': start_literal( "true",  c ); break;
+                case 'f': start_literal( "false", c ); break;
+                case 'n': start_literal( "null",  c ); break;
+
+                default:
+                    if( ( c >= '0' && c <= '9' ) || c == '-' )
+                    {
+                        start_token( number, c );
+                    }
+                    else
+                    {
+                        state_ = error;
+                    }
+            }
+        }
+
+        void start_token( State state, Char_type c )
+        {
+            token_.clear();
+            token_ += c;
+            state_ = state;
+        }
+
+        void start_literal( const char* text, Char_type c )
+        {
+            literal_ = text;
+            start_token( literal, c );
+        }
+
+        void end_value()
+        {
+            state_ = stack_.empty() ? done : value_end;
+        }
+
+        void end_compound( Char_type c )
+        {
+            if( c == '}' )
+            {
+                actions_.end_obj( c );
+            }
+            else
+            {
+                actions_.end_array( c );
+            }
+
+            stack_.pop_back();
+            end_value();
+        }
+
+        void end_string()
+        {
+            const Iter_type begin( token_.begin() );
+            const Iter_type end( token_.end() );
+
+            if( state_ == name )
+            {
+                actions_.new_name( begin, end );
+                state_ = colon;
+            }
+            else
+            {
+                actions_.new_str( begin, end );
+                end_value();
+            }
+        }
+
+        void end_literal()
+        {
+            const Iter_type begin( token_.begin() );
+            const Iter_type end( token_.end() );
+
+            switch( literal_[ 0 ] )
+            {
+                case 't': actions_.new_true ( begin, end ); break;
+                case 'f': actions_.new_false( begin, end ); break;
+                default:  actions_.new_null ( begin, end ); break;
+            }
+
+            end_value();
+        }
+
+        struct Assign_real
+        {
+            Assign_real( double& d ) : d_( d ) {}
+            void operator()( double d ) const { d_ = d; }
+            double& d_;
+        };
+
+        // numbers are handled as the grammar does: anything with a fraction or exponent is
+        // a real, otherwise a 64 bit integer, falling back to unsigned if it's too big; reals
+        // go through the grammar's own parser rather than strtod, which reads the decimal
+        // point from the locale and could round differently
+        //
+        void end_number()
+        {
+            if( !valid_number() )
+            {
+                state_ = error;
+                return;
+            }
+
+            const std::string s( token_.begin(), token_.end() );
+
+            if( s.find_first_of( ".eE" ) != std::string::npos )
+            {
+                double d = 0;
+
+                if( !spirit_namespace::parse( s.c_str(), spirit_namespace::strict_real_p[ Assign_real( d ) ] ).full )
+                {
+                    state_ = error;
+                    return;
+                }
+
+                actions_.new_real( d );
+                end_value();
+                return;
+            }
+
+            errno = 0;
+            const long long i = strtoll( s.c_str(), 0, 10 );
+
+            if( errno == 0 )
+            {
+                actions_.new_int( i );
+            }
+            else
+            {
+                errno = 0;
+                const unsigned long long ui = strtoull( s.c_str(), 0, 10 );
+
+                if( s[ 0 ] == '-' || errno != 0 )
+                {
+                    state_ = error;
+                    return;
+                }
+
+                actions_.new_uint64( ui );
+            }
+
+            end_value();
+        }
+
+        // -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+        //
+        bool valid_number() const
+        {
+            typename String_type::size_type i = 0;
+            const typename String_type::size_type n = token_.size();
+
+            if( i < n && token_[ i ] == '-' ) ++i;
+
+            if( i == n || token_[ i ] < '0' || token_[ i ] > '9' ) return false;
+
+            if( token_[ i ] == '0' )
+            {
+                ++i;
+            }
+            else
+            {
+                while( i < n && token_[ i ] >= '0' && token_[ i ] <= '9' ) ++i;
+            }
+
+            if( i < n && token_[ i ] == '.' )
+            {
+                const typename String_type::size_type start = ++i;
+                while( i < n && token_[ i ] >= '0' && token_[ i ] <= '9' ) ++i;
+                if( i == start ) return false;
+            }
+
+            if( i < n && ( token_[ i ] == 'e' || token_[ i ] == 'E' ) )
+            {
+                ++i;
+                if( i < n && ( token_[ i ] == '+' || token_[ i ] == '-' ) ) ++i;
+                const typename String_type::size_type start = i;
+                while( i < n && token_[ i ] >= '0' && token_[ i ] <= '9' ) ++i;
+                if( i == start ) return false;
+            }
+
+            return i == n;
+        }
+
+        Value_type value_;
+        Semantic_actions< Value_type, Iter_type > actions_;
+
+        State state_;
+        std::vector< char > stack_;     // '{' or '[' for each array or object still open
+        String_type token_;             // the string, name, number or literal being read
+        bool escaped_;                  // the last character of a string was a '\'
+        const char* literal_;           // the literal being matched
+    };
+}
+
+#endif
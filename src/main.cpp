@@ -4,117 +4,125 @@
 
 #include <boost/foreach.hpp>
 
-#include <httpclient.hpp>
+#include <clientengine.hpp>
+#include <coalescing.hpp>
+#include <concurrency.hpp>
+#include <ratelimit.hpp>
+#include <responsecache.hpp>
+#ifdef ENABLE_COROUTINES
+    #include <coroclient.hpp>
+#endif
 
 using namespace std;
 using namespace json_spirit;
 using boost::asio::ip::tcp;
 
-bool readHTTPSecureToString(boost::asio::io_service &io_service, const string server, const string port, const string request, string &response, bool printheaders) {
-    boost::asio::ssl::context context(boost::asio::ssl::context::sslv23);
-    context.set_default_verify_paths();
-    SSLStream sslStream(io_service, context);
-    SSLIOStreamDevice d(sslStream, true);
-
-    string headers;
-    if (!d.HandleRequest(server, port, request, headers, printheaders))
-        return false;
-
-    if (d.IsBufferEmpty()) {
-        printf("readHTTPSecureToString : null message body\n");
-        return false;
-    }
+/* Every call shares one engine, whose io_service threads drive the requests
+ * asynchronously; the blocking calls below just wait on it. */
+HTTPClientEngine &getHTTPEngine() {
+    static TLSContext context;
+    static HTTPClientEngine engine(context);
 
-    d.ReadToString(response);
-    return true;
+    return engine;
 }
 
-bool readHTTPSecureToJSON(boost::asio::io_service &io_service, const string server, const string port, const string request, Object &obj, bool printheaders) {
-    boost::asio::ssl::context context(boost::asio::ssl::context::sslv23);
-    context.set_default_verify_paths();
-    SSLStream sslStream(io_service, context);
-    SSLIOStreamDevice d(sslStream, true);
-
-    string headers;
-    if (!d.HandleRequest(server, port, request, headers, printheaders))
-        return false;
-
-    if (d.IsBufferEmpty()) {
-        printf("readHTTPSecureToString : null message body\n");
-        return false;
-    }
-
-    d.ReadToJSON(obj);
-    return true;
+/* Responses are kept and revalidated, so polling something which hasn't
+ * changed costs a 304 instead of a download and a parse. With HTTP_CACHE_FILE
+ * set they are also kept there, for the next run and any other process
+ * pointed at the same file. */
+HTTPDiskCache *getDiskCache() {
+    static HTTPDiskCache disk;
+    const char *path = getenv("HTTP_CACHE_FILE");
+    if (path && !disk.IsOpen())
+        disk.Open(path);
+
+    return disk.IsOpen() ? &disk : NULL;
 }
 
-bool readHTTPInsecureToString(boost::asio::io_service &io_service, const string server, const string port, const string request, string &response, bool printheaders) {
-    boost::asio::ssl::context context(boost::asio::ssl::context::sslv23);
-    SSLStream sslStream(io_service, context);
-    SSLIOStreamDevice d(sslStream, false);
-
-    string headers;
-    if (!d.HandleRequest(server, port, request, headers, printheaders))
-        return false;
+/* Threads asking for the same thing at once share one request and one parse,
+ * and whatever does go out is paced to the API's rate limit and held to as
+ * many requests at a time as the API answers without slowing down. */
+HTTPRequester &getHTTPClient() {
+    static HTTPConcurrencyLimiter concurrency(getHTTPEngine());
+    static HTTPRateLimitingClient limited(concurrency);
+    static HTTPResponseCache cache(64 << 20, 16, getDiskCache());
+    static HTTPCachingClient cached(limited, cache);
+    static HTTPCoalescingClient client(cached);
+
+    return client;
+}
 
-    if (d.IsBufferEmpty()) {
-        printf("readHTTPInsecureToString : null message body\n");
+bool readHTTPToString(const string server, const string port, const HTTPRequest &request, string &response, bool secure = false, bool printheaders = false) {
+    HTTPResponse res = getHTTPClient().Request(server, port, request, secure).get();
+    if (!check_response("readHTTPToString", server, port, res, printheaders))
         return false;
-    }
 
-    d.ReadToString(response);
+    response.swap(res.body);
     return true;
 }
 
-
-bool readHTTPInsecureToJSON(boost::asio::io_service &io_service, const string server, const string port, const string request, Object &obj, bool printheaders) {
-    boost::asio::ssl::context context(boost::asio::ssl::context::sslv23);
-    SSLStream sslStream(io_service, context);
-    SSLIOStreamDevice d(sslStream, false);
-
-    string headers;
-    if (!d.HandleRequest(server, port, request, headers, printheaders))
+bool readHTTPToJSON(const string server, const string port, const HTTPRequest &request, Object &obj, bool secure = false, bool printheaders = false) {
+    // Parsed as it downloads, ParseJSON only has to parse if that failed.
+    HTTPRequest parsed(request);
+    parsed.SetParseJSON(true);
+    HTTPResponse res = getHTTPClient().Request(server, port, parsed, secure).get();
+    if (!check_response("readHTTPToJSON", server, port, res, printheaders))
         return false;
 
-    if (d.IsBufferEmpty()) {
-        printf("readHTTPInsecureToString : null message body\n");
+    if (!res.ParseJSON() || res.json->type() != obj_type) {
+        printf("readHTTPToJSON : response is not a JSON object\n");
         return false;
     }
 
-    d.ReadToJSON(obj);
+    obj = res.json->get_obj();
     return true;
 }
 
-bool readHTTPToString(const string server, const string port, const string request, string &response, bool secure = false, bool printheaders = false) {
-    boost::asio::io_service io_service;
-    return secure ? readHTTPSecureToString(io_service, server, port, request, response, printheaders) : readHTTPInsecureToString(io_service, server, port, request, response, printheaders);
-}
-
-bool readHTTPToJSON(const string server, const string port, const string request, Object &obj, bool secure = false, bool printheaders = false) {
-    boost::asio::io_service io_service;
+#ifdef ENABLE_COROUTINES
+/* Chained requests read top to bottom as a coroutine: look a user up and then
+ * fetch the repositories listed on their profile. */
+boost::asio::awaitable<void> printUserRepos(AwaitableHTTPClient &client, const HTTPRequestBuilder &builder, const string url, const string user) {
+    Object profile;
+    if (!co_await client.ReadToJSON(url, "https", builder.Build("GET", "/users/" + user), true, profile))
+        co_return;
+
+    string repos_url;
+    BOOST_FOREACH(Pair_impl<Config_vector<string> > p, profile) {
+        if (p.name_ == "repos_url")
+            repos_url = p.value_.get_str();
+    }
+    if (repos_url.compare(0, 8 + url.size(), "https://" + url) != 0)
+        co_return;
 
-    return secure ? readHTTPSecureToJSON(io_service, server, port, request, obj, printheaders) : readHTTPInsecureToJSON(io_service, server, port, request, obj, printheaders);
+    string body;
+    if (co_await client.ReadToString(url, "https", builder.Build("GET", repos_url.substr(8 + url.size())), true, body))
+        printf("%s repositories: %lu bytes\n", user.c_str(), (unsigned long)body.size());
 }
+#endif
 
 int main(int argc, char* argv[]) {
     string url;
     //string response;
 
     url = "api.github.com";
-    stringstream ss1;
-    ss1 << "GET /users/IngCr3at1on HTTP/1.1\r\n"
-        << "Host: " << url << "\r\n"
-        << "Accept: application/vnd.github.v3+json\r\n"
-        << "User-Agent: Irrational HTTPC example\r\n"
-        << "Connection: close\r\n\r\n"
-        ;
+    // Headers every request to the host carries are only formatted once.
+    HTTPRequestBuilder builder(url);
+    builder.AddFixedHeader("Accept", "application/vnd.github.v3+json");
+    builder.AddFixedHeader("Accept-Encoding", HTTPContentDecoder::AcceptEncoding());
+    builder.AddFixedHeader("User-Agent", "Irrational HTTPC example");
+    // Give up on a host which isn't answering rather than hanging.
+    HTTPTimeouts timeouts;
+    timeouts.nConnect = 5000;
+    timeouts.nFirstByte = 15000;
+    timeouts.nTotal = 30000;
+    builder.SetTimeouts(timeouts);
 /*
     response.clear();
-    if (readHTTPToString(url, "https", ss1.str(), response, true))
+    if (readHTTPToString(url, "https", builder.Build("GET", "/users/IngCr3at1on"), response, true))
         printf("%s\n", response.c_str());
 */
     Object obj;
-    if (readHTTPToJSON(url, "https", ss1.str(), obj, true)) {
+    if (readHTTPToJSON(url, "https", builder.Build("GET", "/users/IngCr3at1on"), obj, true)) {
         string name;
         BOOST_FOREACH(Pair_impl<Config_vector<string> > p, obj) {
             if (p.name_ == "name") {
@@ -127,5 +135,12 @@ int main(int argc, char* argv[]) {
             printf("User name: %s\n", name.c_str());
     }
 
+#ifdef ENABLE_COROUTINES
+    boost::asio::io_service io_service;
+    AwaitableHTTPClient coclient(getHTTPClient());
+    boost::asio::co_spawn(io_service, printUserRepos(coclient, builder, url, "IngCr3at1on"), boost::asio::detached);
+    io_service.run();
+#endif
+
     return 0;
 }
@@ -0,0 +1,133 @@
+#ifndef _CANNEDSERVER_HPP_
+#define _CANNEDSERVER_HPP_
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+/** Serves canned responses on a loopback port. Accepted connections take the
+ * scripts added with Expect in turn: each request head read off a connection
+ * is answered with the script's next response, a byte at a time when fTrickle
+ * is set so the client sees every possible split. Once its script runs out a
+ * connection is closed, or held open when fClose is unset. Connections
+ * nothing was expected for are closed straight away. */
+class CannedServer {
+    public:
+        CannedServer() : acceptor(io_service, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)) {
+            fTrickle = false;
+            fStopping = false;
+            thread = boost::thread(boost::bind(&CannedServer::accept, this));
+        }
+
+        ~CannedServer() {
+            {
+                boost::lock_guard<boost::mutex> lock(mutex);
+                fStopping = true;
+                boost::system::error_code ec;
+                for (std::size_t i = 0; i < sockets.size(); i++)
+                    sockets[i]->shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+            }
+
+            // Wake the blocking accept.
+            boost::system::error_code ec;
+            boost::asio::ip::tcp::socket wake(io_service);
+            wake.connect(acceptor.local_endpoint(), ec);
+            thread.join();
+            connections.join_all();
+        }
+
+        /** Answer the next connection with these responses. */
+        void Expect(const std::vector<std::string> &responses, bool fClose = true) {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            scripts.push_back(Script(responses, fClose));
+        }
+
+        std::string GetPort() const {
+            return boost::lexical_cast<std::string>(acceptor.local_endpoint().port());
+        }
+
+        bool fTrickle;
+
+    private:
+        struct Script {
+            Script(const std::vector<std::string> &responsesIn, bool fCloseIn) : responses(responsesIn), fClose(fCloseIn) {}
+
+            std::vector<std::string> responses;
+            bool fClose;
+        };
+
+        void accept() {
+            while (true) {
+                boost::shared_ptr<boost::asio::ip::tcp::socket> socket = boost::make_shared<boost::asio::ip::tcp::socket>(io_service);
+                boost::system::error_code ec;
+                acceptor.accept(*socket, ec);
+
+                boost::lock_guard<boost::mutex> lock(mutex);
+                if (fStopping)
+                    return;
+                if (ec)
+                    continue;
+
+                socket->set_option(boost::asio::ip::tcp::no_delay(true), ec);
+                if (scripts.empty()) {
+                    socket->close(ec);
+                    continue;
+                }
+
+                sockets.push_back(socket);
+                connections.create_thread(boost::bind(&CannedServer::serve, this, socket, scripts.front()));
+                scripts.pop_front();
+            }
+        }
+
+        void serve(boost::shared_ptr<boost::asio::ip::tcp::socket> socket, Script script) {
+            boost::asio::streambuf sb;
+            boost::system::error_code ec;
+            std::size_t i = 0;
+            while (i < script.responses.size() || !script.fClose) {
+                std::size_t n = boost::asio::read_until(*socket, sb, "\r\n\r\n", ec);
+                if (ec || i == script.responses.size())
+                    break;
+                sb.consume(n);
+
+                const std::string &response = script.responses[i++];
+                if (!fTrickle) {
+                    boost::asio::write(*socket, boost::asio::buffer(response), ec);
+                    continue;
+                }
+
+                for (std::size_t j = 0; j < response.size() && !ec; j++) {
+                    boost::asio::write(*socket, boost::asio::buffer(&response[j], 1), ec);
+                    boost::this_thread::sleep(boost::posix_time::microseconds(200));
+                }
+            }
+
+            /* Close gracefully, reading until the client is done, so the
+             * responses aren't lost to a reset over requests left unread. */
+            socket->shutdown(boost::asio::ip::tcp::socket::shutdown_send, ec);
+            char buf[512];
+            while (!ec)
+                socket->read_some(boost::asio::buffer(buf), ec);
+        }
+
+        boost::asio::io_service io_service;
+        boost::asio::ip::tcp::acceptor acceptor;
+        boost::thread thread;
+        boost::thread_group connections;
+
+        boost::mutex mutex;
+        std::deque<Script> scripts;
+        std::vector<boost::shared_ptr<boost::asio::ip::tcp::socket> > sockets;
+        bool fStopping;
+};
+
+#endif // _CANNEDSERVER_HPP_
@@ -0,0 +1,295 @@
+#include <stdio.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <asyncclient.hpp>
+
+#include "cannedserver.hpp"
+
+/* How response bodies are framed: the chunked decoder fed whole and in every
+ * split, and whole responses read by the blocking and async paths, checking
+ * the body and whether the connection was trusted with another request. */
+
+struct DecoderCase {
+    const char *name;
+    const char *data;
+    const char *body;
+    /** Bytes after the message which the decoder must leave alone. */
+    std::size_t nLeftover;
+    bool fDone;
+    bool fError;
+};
+
+const DecoderCase decoderCases[] = {
+    {"plain", "5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n", "hello world", 0, true, false},
+    {"leftover", "5\r\nhello\r\n0\r\n\r\nHTTP/1.1 200 OK\r\n", "hello", 17, true, false},
+    {"hex sizes", "a\r\n0123456789\r\nB\r\nabcdefghijk\r\n0\r\n\r\n", "0123456789abcdefghijk", 0, true, false},
+    {"extensions", "5;name=value\r\nhello\r\n6 ; a; b=\"x;y\"\r\n world\r\n0;last\r\n\r\n", "hello world", 0, true, false},
+    {"trailers", "5\r\nhello\r\n0\r\nX-Checksum: abc\r\nX-Other: 1\r\n\r\nnext", "hello", 4, true, false},
+    {"bare LF", "5\nhello\n0\n\n", "hello", 0, true, false},
+    {"truncated data", "5\r\nhel", "hel", 0, false, false},
+    {"truncated trailer", "5\r\nhello\r\n0\r\nX-Checksum: abc\r\n", "hello", 0, false, false},
+    {"no size", ";ext\r\nhello\r\n0\r\n\r\n", "", 0, false, true},
+    {"data overrun", "5\r\nhelloXX\r\n0\r\n\r\n", "hello", 0, false, true},
+    {"oversized", "1000000000000000\r\nhello\r\n", "", 0, false, true},
+};
+
+/* Feed the decoder the data in pieces starting at each of splits, stopping as
+ * soon as it says it's finished. */
+struct Decoded {
+    std::string body;
+    std::size_t nUsed;
+    bool fDone;
+    bool fError;
+};
+
+Decoded decode(const std::string &data, const std::vector<std::size_t> &splits) {
+    HTTPChunkedDecoder decoder;
+    Decoded result;
+    result.nUsed = 0;
+    for (std::size_t i = 0; i <= splits.size() && !decoder.IsDone() && !decoder.IsError(); i++) {
+        std::size_t nBegin = i == 0 ? 0 : splits[i - 1];
+        std::size_t nEnd = i == splits.size() ? data.size() : splits[i];
+        std::size_t nUsed = decoder.Decode(data.data() + nBegin, nEnd - nBegin, result.body);
+        result.nUsed += nUsed;
+        if (nUsed < nEnd - nBegin && !decoder.IsDone() && !decoder.IsError()) {
+            printf("framing : decoder stopped short without finishing\n");
+            result.fDone = false;
+            result.fError = true;
+            return result;
+        }
+    }
+
+    result.fDone = decoder.IsDone();
+    result.fError = decoder.IsError();
+    return result;
+}
+
+bool check_decoded(const DecoderCase &c, const char *how, const Decoded &result) {
+    std::string data(c.data);
+    // Where an error is noticed, and so what was used, can depend on the split.
+    bool fOk = result.fDone == c.fDone && result.fError == c.fError && (c.fError || result.nUsed == data.size() - c.nLeftover);
+    if (!c.fError)
+        fOk &= result.body == c.body;
+    if (!fOk)
+        printf("framing : decoder %s (%s) got \"%s\" used %u done %d error %d\n", c.name, how, result.body.c_str(), (unsigned int)result.nUsed, result.fDone, result.fError);
+    return fOk;
+}
+
+bool test_decoder(const DecoderCase &c) {
+    std::string data(c.data);
+    bool fOk = check_decoded(c, "whole", decode(data, std::vector<std::size_t>()));
+
+    std::vector<std::size_t> bytes;
+    for (std::size_t i = 1; i < data.size(); i++)
+        bytes.push_back(i);
+    fOk &= check_decoded(c, "byte at a time", decode(data, bytes));
+
+    for (std::size_t i = 1; i < data.size(); i++)
+        fOk &= check_decoded(c, "split", decode(data, std::vector<std::size_t>(1, i)));
+
+    return fOk;
+}
+
+const char *REQUEST = "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+const char *NEXT = "HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\nnext";
+
+struct ResponseCase {
+    std::string name;
+    std::string response;
+    /** The body, or NULL when the response must be refused. */
+    const char *body;
+    /** Whether the connection may be used for the next request. */
+    bool fReusable;
+    /** Whether the body only ends with the connection, otherwise it's held
+     * open so reusing it when the client shouldn't is noticed. */
+    bool fCloseDelimited;
+    /** Only sent whole, leftover bytes split off the end of a response
+     * would look like a clean end. */
+    bool fWholeOnly;
+};
+
+const ResponseCase plainCases[] = {
+    {"content-length",
+        "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello", "hello", true, false, false},
+    {"chunked with extensions and trailers",
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5;ext=1\r\nhello\r\n6\r\n world\r\n0\r\nX-Checksum: abc\r\n\r\n", "hello world", true, false, false},
+    {"transfer-encoding overrides content-length",
+        "HTTP/1.1 200 OK\r\nContent-Length: 100\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n0\r\n\r\n", "hello", false, false, false},
+    {"content-length after transfer-encoding",
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\nContent-Length: 2\r\n\r\n5\r\nhello\r\n0\r\n\r\n", "hello", false, false, false},
+    {"repeated content-length",
+        "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nContent-Length: 5\r\n\r\nhello", "hello", true, false, false},
+    {"conflicting content-length",
+        "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nContent-Length: 6\r\n\r\nhello!", NULL, false, false, false},
+    {"invalid content-length",
+        "HTTP/1.1 200 OK\r\nContent-Length: -5\r\n\r\nhello", NULL, false, false, false},
+    {"close-delimited",
+        "HTTP/1.1 200 OK\r\n\r\nhello world", "hello world", false, true, false},
+    {"non-chunked transfer-encoding is close-delimited",
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: identity\r\nContent-Length: 5\r\n\r\nhello world", "hello world", false, true, false},
+    {"leftover after content-length",
+        "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhelloGARBAGE", "hello", false, false, true},
+    {"leftover after chunked",
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n0\r\n\r\nGARBAGE", "hello", false, false, true},
+};
+
+/* Compress in the zlib format, which is what the deflate coding means. */
+std::string deflate(const std::string &data) {
+    uLongf nSize = compressBound(data.size());
+    std::string compressed(nSize, '\0');
+    compress2((Bytef*)&compressed[0], &nSize, (const Bytef*)data.data(), data.size(), Z_BEST_COMPRESSION);
+    compressed.resize(nSize);
+    return compressed;
+}
+
+std::string length_of(const std::string &data) {
+    return boost::lexical_cast<std::string>(data.size());
+}
+
+/* Compressed bodies are read a piece at a time and decompressed as they
+ * go, rather than read whole. */
+std::vector<ResponseCase> coded_cases() {
+    const std::string head = "HTTP/1.1 200 OK\r\nContent-Encoding: deflate\r\n";
+    const std::string z = deflate("hello world");
+    const std::string half = z.substr(0, z.size() / 2), rest = z.substr(z.size() / 2);
+    const ResponseCase cases[] = {
+        {"deflate with content-length",
+            head + "Content-Length: " + length_of(z) + "\r\n\r\n" + z, "hello world", true, false, false},
+        {"deflate chunked",
+            head + "Transfer-Encoding: chunked\r\n\r\n" + (boost::format("%x\r\n") % half.size()).str() + half + "\r\n" + (boost::format("%x\r\n") % rest.size()).str() + rest + "\r\n0\r\n\r\n", "hello world", true, false, false},
+        {"deflate close-delimited",
+            head + "\r\n" + z, "hello world", false, true, false},
+        {"deflate cut short by content-length",
+            head + "Content-Length: " + length_of(half) + "\r\n\r\n" + half, NULL, false, false, false},
+        {"leftover after deflate",
+            head + "Content-Length: " + length_of(z) + "\r\n\r\n" + z + "GARBAGE", "hello world", false, false, true},
+    };
+
+    return std::vector<ResponseCase>(cases, cases + sizeof(cases) / sizeof(cases[0]));
+}
+
+/* The first connection gets the case's response, followed by the next one if
+ * the client should reuse it. A second connection is there for the next
+ * request if it shouldn't. */
+void expect(CannedServer &server, const ResponseCase &c) {
+    std::vector<std::string> script(1, c.response);
+    if (c.fReusable)
+        script.push_back(NEXT);
+    server.Expect(script, c.fReusable || c.fCloseDelimited);
+    server.Expect(std::vector<std::string>(1, NEXT));
+}
+
+bool check_response(const ResponseCase &c, const char *how, bool fOk, const std::string &body, bool fNextOk, uint64_t nHits) {
+    bool fPassed = c.body ? fOk && body == c.body : !fOk;
+    fPassed &= fNextOk && nHits == (c.fReusable ? 1 : 0);
+    if (!fPassed)
+        printf("framing : %s (%s) got %d \"%s\", next %d, %u reused\n", c.name.c_str(), how, fOk, body.c_str(), fNextOk, (unsigned int)nHits);
+    return fPassed;
+}
+
+bool run_sync(const ResponseCase &c, bool fTrickle) {
+    CannedServer server;
+    server.fTrickle = fTrickle;
+    expect(server, c);
+
+    boost::asio::io_service io_service;
+    TLSContext context;
+    HTTPConnectionPool pool(io_service, context);
+    std::string headers, body, next;
+    bool fOk, fNextOk;
+    {
+        SSLIOStreamDevice device(pool, false);
+        fOk = device.HandleRequest("127.0.0.1", server.GetPort(), HTTPRequest(REQUEST), headers);
+        device.TakeBody(body);
+    }
+    {
+        SSLIOStreamDevice device(pool, false);
+        fNextOk = device.HandleRequest("127.0.0.1", server.GetPort(), HTTPRequest(REQUEST), headers);
+        device.TakeBody(next);
+    }
+
+    return check_response(c, fTrickle ? "sync, trickled" : "sync", fOk, body, fNextOk && next == "next", pool.GetStats().nHits);
+}
+
+bool run_async(const ResponseCase &c, bool fTrickle) {
+    CannedServer server;
+    server.fTrickle = fTrickle;
+    expect(server, c);
+
+    boost::asio::io_service io_service;
+    boost::asio::executor_work_guard<boost::asio::io_service::executor_type> work = boost::asio::make_work_guard(io_service);
+    boost::thread thread(boost::bind(&boost::asio::io_service::run, &io_service));
+    TLSContext context;
+    HTTPConnectionPool pool(io_service, context);
+    AsyncHTTPClient client(pool);
+    HTTPResponse response = client.Request("127.0.0.1", server.GetPort(), HTTPRequest(REQUEST), false).get();
+    HTTPResponse next = client.Request("127.0.0.1", server.GetPort(), HTTPRequest(REQUEST), false).get();
+    bool fPassed = check_response(c, fTrickle ? "async, trickled" : "async", !response.ec && response.nStatus == 200, response.body, !next.ec && next.body == "next", pool.GetStats().nHits);
+
+    work.reset();
+    pool.Shutdown();
+    thread.join();
+    return fPassed;
+}
+
+/* A pipeline reads each response straight after the last, with the start of
+ * the next one usually already buffered. A close-delimited response ends the
+ * connection, and whatever was left unanswered goes again on a new one. */
+bool run_pipeline(bool fTrickle) {
+    CannedServer server;
+    server.fTrickle = fTrickle;
+    std::vector<std::string> script;
+    script.push_back("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n1;ext\r\na\r\n0\r\nX-Trailer: 1\r\n\r\n");
+    script.push_back("HTTP/1.1 200 OK\r\nContent-Length: 1\r\nContent-Length: 1\r\n\r\nb");
+    script.push_back("HTTP/1.1 200 OK\r\n\r\nc");
+    server.Expect(script);
+    server.Expect(std::vector<std::string>(1, "HTTP/1.1 200 OK\r\nContent-Length: 1\r\n\r\nd"));
+
+    boost::asio::io_service io_service;
+    TLSContext context;
+    HTTPConnectionPool pool(io_service, context);
+    SSLIOStreamDevice device(pool, false);
+    std::vector<std::string> requests(4, REQUEST);
+    std::vector<HTTPResponse> responses;
+    bool fOk = device.HandlePipeline("127.0.0.1", server.GetPort(), requests, responses);
+
+    std::string bodies;
+    for (std::size_t i = 0; i < responses.size(); i++)
+        bodies += responses[i].ec ? "!" : responses[i].body;
+    if (!fOk || bodies != "abcd") {
+        printf("framing : pipeline (%s) got %d \"%s\"\n", fTrickle ? "trickled" : "whole", fOk, bodies.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+int main() {
+    bool fOk = true;
+    for (std::size_t i = 0; i < sizeof(decoderCases) / sizeof(decoderCases[0]); i++)
+        fOk &= test_decoder(decoderCases[i]);
+
+    std::vector<ResponseCase> cases(plainCases, plainCases + sizeof(plainCases) / sizeof(plainCases[0]));
+    std::vector<ResponseCase> coded = coded_cases();
+    cases.insert(cases.end(), coded.begin(), coded.end());
+    for (std::size_t i = 0; i < cases.size(); i++) {
+        for (int fTrickle = 0; fTrickle < (cases[i].fWholeOnly ? 1 : 2); fTrickle++) {
+            fOk &= run_sync(cases[i], fTrickle);
+            fOk &= run_async(cases[i], fTrickle);
+        }
+    }
+
+    for (int fTrickle = 0; fTrickle < 2; fTrickle++)
+        fOk &= run_pipeline(fTrickle);
+
+    printf("framing : %s\n", fOk ? "ok" : "failed");
+    return fOk ? 0 : 1;
+}
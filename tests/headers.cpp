@@ -0,0 +1,174 @@
+#include <stdio.h>
+
+#include <string>
+#include <utility>
+
+#include <boost/asio.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <httpclient.hpp>
+
+/* The one-pass head parser and the header index it fills in: folded values,
+ * lookups ignoring case, more headers than the index keeps inline, heads cut
+ * short or with bare LFs, and whitespace around values. */
+
+bool fOk = true;
+
+void expect(bool fCondition, const char *name, const char *what) {
+    if (!fCondition) {
+        printf("headers : %s : %s\n", name, what);
+        fOk = false;
+    }
+}
+
+void expect_value(boost::string_view value, const char *expected, const char *name, const char *what) {
+    if (value != boost::string_view(expected)) {
+        printf("headers : %s : %s is \"%s\"\n", name, what, std::string(value.data(), value.size()).c_str());
+        fOk = false;
+    }
+}
+
+/* Parse a head followed by body bytes, checking the body is all that's left
+ * behind. */
+bool parse(HTTPResponseHead &head, const std::string &text, const std::string &body = "") {
+    boost::asio::streambuf sb;
+    std::ostream(&sb) << text << body;
+    if (!head.Parse(sb))
+        return false;
+
+    return std::string(boost::asio::buffer_cast<const char*>(sb.data()), sb.size()) == body;
+}
+
+void test_case_insensitive() {
+    const char *name = "case-insensitive lookup";
+    HTTPResponseHead head;
+    expect(parse(head, "HTTP/1.1 200 OK\r\n"
+        "content-LENGTH: 5\r\n"
+        "X-Custom-Header: first\r\n"
+        "x-custom-header: second\r\n"
+        "ETAG: \"abc\"\r\n"
+        "\r\n", "hello"), name, "parse failed");
+
+    expect(head.nContentLength == 5, name, "length not taken from a lower-case name");
+    expect_value(head.GetHeader(HEADER_CONTENT_LENGTH), "5", name, "Content-Length by id");
+    expect_value(head.GetHeader("Content-Length"), "5", name, "Content-Length by name");
+    expect_value(head.GetHeader("CONTENT-length"), "5", name, "CONTENT-length");
+    expect_value(head.GetHeader("ETag"), "\"abc\"", name, "ETag");
+    expect_value(head.GetHeader("x-CUSTOM-header"), "first", name, "first of a repeated header");
+    expect(head.GetHeader("X-Custom-Headers").empty(), name, "longer name matched");
+    expect(head.GetHeader("X-Custom-Heade").empty(), name, "shorter name matched");
+    // Only letters differ by 0x20 between cases.
+    expect(HTTPHeaderIndex::Classify("Content\rLength", 14) == HEADER_OTHER, name, "non-letter matched ignoring case");
+    expect(HTTPHeaderIndex::Classify("AGE", 3) == HEADER_AGE, name, "AGE");
+}
+
+void test_many_fields() {
+    const char *name = "more fields than kept inline";
+    std::string text = "HTTP/1.1 200 OK\r\n";
+    for (int i = 0; i < 100; i++) {
+        text += "X-Field-" + boost::lexical_cast<std::string>(i) + ": value " + boost::lexical_cast<std::string>(i) + "\r\n";
+        if (i == 50)
+            text += "Content-Length: 5\r\n";
+    }
+    text += "Retry-After: 7\r\n\r\n";
+
+    HTTPResponseHead head;
+    expect(parse(head, text, "hello"), name, "parse failed");
+    expect(head.index.Count() == 102, name, "wrong count");
+    expect(head.nContentLength == 5, name, "length past the inline fields");
+    expect_value(head.GetHeader(HEADER_RETRY_AFTER), "7", name, "Retry-After by id");
+    expect_value(head.GetHeader("x-field-0"), "value 0", name, "first field");
+    expect_value(head.GetHeader("X-Field-31"), "value 31", name, "last inline field");
+    expect_value(head.GetHeader("X-Field-32"), "value 32", name, "first spilled field");
+    expect_value(head.GetHeader("X-Field-99"), "value 99", name, "last field");
+    expect_value(head.index.GetName(head.headers, 51), "Content-Length", name, "name by position");
+    expect_value(head.index.GetValue(head.headers, 101), "7", name, "value by position");
+}
+
+void test_obs_fold() {
+    const char *name = "obs-fold";
+    HTTPResponseHead head;
+    expect(parse(head, "HTTP/1.1 200 OK\r\n"
+        "X-Folded: one\r\n"
+        "  two\r\n"
+        "\tthree  \r\n"
+        "X-Colon: a\r\n"
+        " b: c\r\n"
+        "Transfer-Encoding: gzip,\r\n"
+        " chunked\r\n"
+        "X-After: yes\r\n"
+        "\r\n"), name, "parse failed");
+
+    expect_value(head.GetHeader("X-Folded"), "one two three", name, "folded value");
+    // A fold with a colon in it continues the value, it isn't a header.
+    expect_value(head.GetHeader("X-Colon"), "a b: c", name, "folded value with a colon");
+    expect(head.GetHeader(" b").empty() && head.GetHeader("b").empty(), name, "fold indexed as a header");
+    expect_value(head.GetHeader(HEADER_TRANSFER_ENCODING), "gzip, chunked", name, "folded Transfer-Encoding");
+    expect(head.fChunked, name, "chunked coding lost in the fold");
+    expect_value(head.GetHeader("X-After"), "yes", name, "header after the folds");
+    expect(head.index.Count() == 4, name, "wrong count");
+    expect(head.headers == "HTTP/1.1 200 OK\nX-Folded: one two three  \nX-Colon: a b: c\nTransfer-Encoding: gzip, chunked\nX-After: yes", name, "headers text still folded");
+
+    HTTPResponseHead length;
+    expect(parse(length, "HTTP/1.1 200 OK\r\nContent-Length:\r\n 5\r\n\r\n", "hello"), name, "folded Content-Length");
+    expect(length.nContentLength == 5, name, "folded Content-Length value");
+
+    // Nothing to continue, so kept but not indexed.
+    HTTPResponseHead first;
+    expect(parse(first, "HTTP/1.1 200 OK\r\n X-Leading: 1\r\nContent-Length: 0\r\n\r\n"), name, "leading fold");
+    expect(first.index.Count() == 1 && first.GetHeader("X-Leading").empty(), name, "leading fold indexed");
+    expect(first.nContentLength == 0, name, "header after a leading fold");
+
+    HTTPResponseHead cut;
+    expect(!parse(cut, "HTTP/1.1 200 OK\r\nX-Folded: one\r\n two"), name, "fold cut short parsed");
+}
+
+void test_missing_crlf() {
+    const char *name = "missing CRLF";
+    HTTPResponseHead head;
+    expect(!parse(head, "HTTP/1.1 200 OK"), name, "status line alone parsed");
+    expect(!parse(head, "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n"), name, "head without a blank line parsed");
+    expect(!parse(head, "HTTP/1.1 200 OK\r\nContent-Length: 5"), name, "unterminated header parsed");
+    expect(!parse(head, "HTTP/1.1 200 OK\r\nContent-Length: 5\r\r\n\r\n"), name, "stray CR parsed as a length");
+    // A bare LF could hide a header from anything splitting the text on lines.
+    expect(!parse(head, "HTTP/1.1 200 OK\r\nX-A: 1\nContent-Length: 5\r\n\r\n"), name, "bare LF parsed");
+    expect(!parse(head, "HTTP/1.1 200 OK\r\nX-A: 1\r\n \nContent-Length: 5\r\n\r\n"), name, "bare LF in a fold parsed");
+    expect(!parse(head, "HTTP/1.1 200 OK\n\n"), name, "LF-only head parsed");
+}
+
+void test_whitespace() {
+    const char *name = "whitespace around values";
+    HTTPResponseHead head;
+    expect(parse(head, "HTTP/1.1 200 OK\r\n"
+        "Content-Type: \t application/json \t \r\n"
+        "Content-Length:5\r\n"
+        "Connection:   close\t\r\n"
+        "X-Empty:\r\n"
+        "X-Blank: \t \r\n"
+        "X-Inner: a  b\r\n"
+        "\r\n", "hello"), name, "parse failed");
+
+    expect_value(head.GetHeader(HEADER_CONTENT_TYPE), "application/json", name, "Content-Type");
+    expect(head.nContentLength == 5, name, "length without a space");
+    expect(!head.fKeepAlive, name, "Connection: close with whitespace");
+    expect(head.index.Count() == 6, name, "empty values dropped");
+    expect(head.GetHeader("X-Empty").empty(), name, "X-Empty");
+    expect(head.GetHeader("X-Blank").empty(), name, "X-Blank");
+    expect_value(head.GetHeader("X-Inner"), "a  b", name, "inner whitespace");
+
+    HTTPResponseHead padded;
+    expect(parse(padded, "HTTP/1.1 200 OK\r\nContent-Length:  5  \r\n\r\n", "hello"), name, "padded length");
+    expect(padded.nContentLength == 5, name, "padded length value");
+    expect(!parse(padded, "HTTP/1.1 200 OK\r\nContent-Length: 5 5\r\n\r\n", "hello"), name, "length with inner space parsed");
+}
+
+int main() {
+    test_case_insensitive();
+    test_many_fields();
+    test_obs_fold();
+    test_missing_crlf();
+    test_whitespace();
+
+    printf("headers : %s\n", fOk ? "ok" : "failed");
+    return fOk ? 0 : 1;
+}
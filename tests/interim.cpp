@@ -0,0 +1,110 @@
+#include <stdio.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <asyncclient.hpp>
+
+#include "cannedserver.hpp"
+
+/* Interim 1xx responses come ahead of the real response to a request and must
+ * be skipped, leaving the connection in step for the next request, on both
+ * the blocking and async paths and however the responses arrive split. */
+
+const char *REQUEST = "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+const char *NEXT = "HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\nnext";
+
+struct Case {
+    const char *name;
+    const char *response;
+    const char *body;
+};
+
+const Case cases[] = {
+    {"100 Continue",
+        "HTTP/1.1 100 Continue\r\n\r\n"
+        "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello", "hello"},
+    {"103 Early Hints",
+        "HTTP/1.1 103 Early Hints\r\nLink: </style.css>; rel=preload; as=style\r\n\r\n"
+        "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello", "hello"},
+    {"100 then 103 then chunked",
+        "HTTP/1.1 100 Continue\r\n\r\n"
+        "HTTP/1.1 103 Early Hints\r\nLink: </a.js>; rel=preload\r\n\r\n"
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n0\r\n\r\n", "hello"},
+};
+
+bool check(const char *name, const char *path, unsigned int nStatus, const std::string &body, const std::string &expected) {
+    if (nStatus == 200 && body == expected)
+        return true;
+
+    printf("interim : %s (%s) got %u \"%s\"\n", name, path, nStatus, body.c_str());
+    return false;
+}
+
+bool run_sync(const Case &c, bool fTrickle) {
+    CannedServer server;
+    server.fTrickle = fTrickle;
+    std::vector<std::string> script;
+    script.push_back(c.response);
+    script.push_back(NEXT);
+    server.Expect(script);
+
+    boost::asio::io_service io_service;
+    TLSContext context;
+    HTTPConnectionPool pool(io_service, context);
+    bool fOk = true;
+    for (int i = 0; i < 2; i++) {
+        SSLIOStreamDevice device(pool, false);
+        std::string headers, body;
+        unsigned int nStatus = 0;
+        if (device.HandleRequest("127.0.0.1", server.GetPort(), HTTPRequest(REQUEST), headers) && headers.compare(0, 12, "HTTP/1.1 200") == 0)
+            nStatus = 200;
+        device.TakeBody(body);
+        fOk &= check(c.name, "sync", nStatus, body, i == 0 ? c.body : "next");
+    }
+
+    return fOk;
+}
+
+bool run_async(const Case &c, bool fTrickle) {
+    CannedServer server;
+    server.fTrickle = fTrickle;
+    std::vector<std::string> script;
+    script.push_back(c.response);
+    script.push_back(NEXT);
+    server.Expect(script);
+
+    boost::asio::io_service io_service;
+    boost::asio::executor_work_guard<boost::asio::io_service::executor_type> work = boost::asio::make_work_guard(io_service);
+    boost::thread thread(boost::bind(&boost::asio::io_service::run, &io_service));
+    TLSContext context;
+    HTTPConnectionPool pool(io_service, context);
+    AsyncHTTPClient client(pool);
+    bool fOk = true;
+    for (int i = 0; i < 2; i++) {
+        HTTPResponse response = client.Request("127.0.0.1", server.GetPort(), HTTPRequest(REQUEST), false).get();
+        fOk &= check(c.name, "async", response.ec ? 0 : response.nStatus, response.body, i == 0 ? c.body : "next");
+    }
+
+    work.reset();
+    pool.Shutdown();
+    thread.join();
+    return fOk;
+}
+
+int main() {
+    bool fOk = true;
+    for (std::size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        for (int fTrickle = 0; fTrickle < 2; fTrickle++) {
+            fOk &= run_sync(cases[i], fTrickle);
+            fOk &= run_async(cases[i], fTrickle);
+        }
+    }
+
+    printf("interim : %s\n", fOk ? "ok" : "failed");
+    return fOk ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+#include <locale.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include <json_spirit/json_spirit.h>
+#include <json_spirit/json_spirit_push_reader.h>
+
+/* The push reader has to build the same value as json_spirit::read however the
+ * text is split between feeds, and read numbers the same whatever the locale
+ * says a decimal point is. */
+
+const char *valid[] = {
+    "{\"quote\":\"a\\\"b\",\"backslash\":\"c\\\\d\",\"slash\":\"\\/\",\"controls\":\"\\b\\f\\n\\r\\t\",\"latin\":\"caf\\u00e9\",\"euro\":\"\\u20AC\",\"\":\"\"}",
+    "[\"\\ud83d\\ude00\", \"x\\uD834\\uDD1Ey\", \"\\\\u0041\"]",
+    "[0, -0, 1, -1, 1.5, -2.25e3, 1E+2, 6.02e-23, 0.1, 1e-7, 123456789.125, 9223372036854775807, -9223372036854775808, 18446744073709551615]",
+    "{\"a\":{\"b\":[1,{\"c\":[[],{}]},[[[true]]]],\"d\":null},\"e\":[false,\"x\",{\"f\":{\"g\":{\"h\":[0.5]}}}]}",
+    " \n\t[ 1 ,\r\n { \"k\" : \"v\" } , [ ] ] \n",
+    "\"just a string\"",
+    "-12.5e-1",
+    "42",
+    "true",
+    "null",
+};
+
+const char *invalid[] = {
+    "[1,]",
+    "{\"a\" 1}",
+    "{\"a\":1,}",
+    "{\"a\":[1}",
+    "[1e]",
+    "[-]",
+    "tru",
+    "[\"unterminated]",
+    "",
+};
+
+/* Feed the text in two pieces split at nSplit, or a byte at a time when
+ * nSplit is npos. */
+bool push_read(const std::string &text, std::size_t nSplit, json_spirit::Value &value) {
+    json_spirit::Push_reader<json_spirit::Value> reader;
+    bool fOk = true;
+    if (nSplit == std::string::npos) {
+        for (std::size_t i = 0; i < text.size() && fOk; i++)
+            fOk = reader.feed(&text[i], 1);
+    } else {
+        fOk = reader.feed(text.data(), nSplit) && reader.feed(text.data() + nSplit, text.size() - nSplit);
+    }
+
+    if (!fOk || !reader.finish())
+        return false;
+
+    value = reader.get_value();
+    return true;
+}
+
+/* Every split of the text has to give expected, or fail when fExpected is
+ * unset. */
+bool check_splits(const std::string &text, bool fExpected, const json_spirit::Value &expected, const char *how) {
+    bool fOk = true;
+    for (std::size_t nSplit = 0; nSplit <= text.size() + 1; nSplit++) {
+        std::size_t n = nSplit > text.size() ? std::string::npos : nSplit;
+        json_spirit::Value value;
+        bool fRead = push_read(text, n, value);
+        if (fRead != fExpected || (fRead && !(value == expected))) {
+            printf("pushreader : %s split at %d%s : %s\n", text.c_str(), n == std::string::npos ? -1 : (int)n, how, fRead ? "wrong value" : fExpected ? "failed" : "accepted");
+            fOk = false;
+        }
+    }
+
+    return fOk;
+}
+
+/* Locales which write 1,5 for 1.5, any one installed will do. */
+bool set_comma_locale() {
+    const char *names[] = {"de_DE.UTF-8", "de_DE.utf8", "de_DE", "fr_FR.UTF-8", "fr_FR.utf8", "fr_FR", "ru_RU.UTF-8", "ru_RU.utf8"};
+    for (std::size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (setlocale(LC_NUMERIC, names[i]) && strcmp(localeconv()->decimal_point, ",") == 0)
+            return true;
+    }
+
+    return false;
+}
+
+int main() {
+    bool fOk = true;
+    json_spirit::Value numbers;
+    for (std::size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+        json_spirit::Value expected;
+        if (!json_spirit::read(std::string(valid[i]), expected)) {
+            printf("pushreader : read refused %s\n", valid[i]);
+            fOk = false;
+            continue;
+        }
+
+        fOk &= check_splits(valid[i], true, expected, "");
+        if (i == 2)
+            numbers = expected;
+    }
+
+    for (std::size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        json_spirit::Value value;
+        if (json_spirit::read(std::string(invalid[i]), value)) {
+            printf("pushreader : read accepted %s\n", invalid[i]);
+            fOk = false;
+        }
+
+        fOk &= check_splits(invalid[i], false, json_spirit::Value(), "");
+    }
+
+    // Compared with what was read under the C locale.
+    if (set_comma_locale()) {
+        fOk &= check_splits(valid[2], true, numbers, " with a comma decimal point");
+        setlocale(LC_NUMERIC, "C");
+    } else {
+        printf("pushreader : no locale with a comma decimal point, not checking numbers under one\n");
+    }
+
+    printf("pushreader : %s\n", fOk ? "ok" : "failed");
+    return fOk ? 0 : 1;
+}
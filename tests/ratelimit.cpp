@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <utility>
+
+#include <boost/asio.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <ratelimit.hpp>
+
+/* Answers every request from a pool of threads of its own after a moment,
+ * with a large quota due to reset shortly, so responses keep changing the
+ * rate while alarms keep releasing the queue. */
+class FakeHost : public HTTPRequester {
+    public:
+        FakeHost() : work(boost::asio::make_work_guard(io_service)) {
+            for (int i = 0; i < 4; i++)
+                threads.create_thread(boost::bind(&boost::asio::io_service::run, &io_service));
+        }
+
+        ~FakeHost() {
+            work.reset();
+            threads.join_all();
+        }
+
+        void AsyncRequest(const std::string &/*server*/, const std::string &/*port*/, const HTTPRequest &/*request*/, bool /*fUseSSL*/, HTTPResponseHandler handler) {
+            boost::asio::post(io_service, boost::bind(&FakeHost::respond, handler));
+        }
+
+    private:
+        static void respond(HTTPResponseHandler handler) {
+            std::string head = "HTTP/1.1 200 OK\r\n"
+                "X-RateLimit-Limit: 1000000\r\n"
+                "X-RateLimit-Remaining: 100000\r\n"
+                "X-RateLimit-Reset: " + boost::lexical_cast<std::string>(time(NULL) + 2) + "\r\n"
+                "\r\n";
+            boost::asio::streambuf sb;
+            std::ostream(&sb) << head;
+            HTTPResponseHead parsed;
+            parsed.Parse(sb);
+
+            HTTPResponse response;
+            response.nStatus = parsed.nStatus;
+            response.headers = parsed.headers;
+            response.index = parsed.index;
+            handler(response);
+        }
+
+        boost::asio::io_service io_service;
+        boost::asio::executor_work_guard<boost::asio::io_service::executor_type> work;
+        boost::thread_group threads;
+};
+
+/* Gives up on a test which has deadlocked, any thread can be stuck including
+ * the main one. */
+void watch(std::atomic<bool> *pfDone) {
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while (!*pfDone && std::chrono::steady_clock::now() < end)
+        boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+
+    if (!*pfDone) {
+        printf("ratelimit : deadlocked\n");
+        fflush(stdout);
+        // Deadlocked threads can't be joined.
+        _exit(1);
+    }
+}
+
+/* Responses coming back while the watchdog is releasing requests used to
+ * deadlock, each holding one of the client's and the alarm's locks while
+ * waiting for the other. */
+int main() {
+    const int nRequests = 20000;
+    std::atomic<bool> fDone(false);
+    boost::thread watchdog(boost::bind(watch, &fDone));
+
+    FakeHost host;
+    HTTPRateLimitingClient client(host);
+
+    std::atomic<int> nAnswered(0);
+    std::atomic<int> nFailed(0);
+    for (int i = 0; i < nRequests; i++) {
+        client.AsyncRequest("example.com", "443", HTTPRequest("GET / HTTP/1.1\r\nHost: example.com\r\n\r\n"), true, [&](const HTTPResponse &response) {
+            if (response.ec || response.nStatus != 200)
+                nFailed++;
+            nAnswered++;
+        });
+    }
+
+    while (nAnswered < nRequests)
+        boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    fDone = true;
+    watchdog.join();
+
+    HTTPRateLimitStats stats = client.GetStats();
+    printf("ratelimit : %d requests, %d delayed, %d failed\n", nRequests, (int)stats.nDelayed, (int)nFailed);
+    return nFailed ? 1 : 0;
+}
@@ -0,0 +1,213 @@
+#include <stdio.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+#include <zlib.h>
+
+#include <responsecache.hpp>
+
+#include "cannedserver.hpp"
+
+/* The async engine hands a body to the request's sink as it is read, and
+ * parses JSON as it downloads, for every way a body can be framed; a sink can
+ * abandon a response part way, and a streamed body is never cached. */
+
+const char *REQUEST = "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+const char *NEXT = "HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\nnext";
+
+bool fOk = true;
+
+void expect(bool fCondition, const std::string &name, const char *what) {
+    if (!fCondition) {
+        printf("streaming : %s : %s\n", name.c_str(), what);
+        fOk = false;
+    }
+}
+
+/* Compress in the zlib format, which is what the deflate coding means. */
+std::string deflate(const std::string &data) {
+    uLongf nSize = compressBound(data.size());
+    std::string compressed(nSize, '\0');
+    compress2((Bytef*)&compressed[0], &nSize, (const Bytef*)data.data(), data.size(), Z_BEST_COMPRESSION);
+    compressed.resize(nSize);
+    return compressed;
+}
+
+std::string length_of(const std::string &data) {
+    return boost::lexical_cast<std::string>(data.size());
+}
+
+/* A client on its own io_service thread, stopped on destruction. */
+class Client {
+    public:
+        Client() : work(boost::asio::make_work_guard(io_service)), pool(io_service, context), client(pool) {
+            thread = boost::thread(boost::bind(&boost::asio::io_service::run, &io_service));
+        }
+
+        ~Client() {
+            work.reset();
+            pool.Shutdown();
+            thread.join();
+        }
+
+        boost::asio::io_service io_service;
+        boost::asio::executor_work_guard<boost::asio::io_service::executor_type> work;
+        TLSContext context;
+        HTTPConnectionPool pool;
+        AsyncHTTPClient client;
+        boost::thread thread;
+};
+
+/* Collects what a sink is given, giving up after nLimit calls when it is
+ * set. */
+struct Collected {
+    Collected() : nCalls(0), nLimit(0) {}
+
+    bool Sink(const char *data, std::size_t size) {
+        received.append(data, size);
+        return ++nCalls != nLimit;
+    }
+
+    std::string received;
+    unsigned int nCalls;
+    unsigned int nLimit;
+};
+
+void fulfill(boost::shared_ptr<std::promise<HTTPResponse> > promise, const HTTPResponse &response) {
+    promise->set_value(response);
+}
+
+HTTPResponse streamed(HTTPRequester &requester, const std::string &port, Collected &collected) {
+    boost::shared_ptr<std::promise<HTTPResponse> > promise = boost::make_shared<std::promise<HTTPResponse> >();
+    std::future<HTTPResponse> future = promise->get_future();
+    requester.AsyncStreamingRequest("127.0.0.1", port, HTTPRequest(REQUEST), false, boost::bind(&Collected::Sink, &collected, _1, _2), boost::bind(fulfill, promise, _1));
+    return future.get();
+}
+
+void test_sink(const std::string &name, const std::string &response, const std::string &body, bool fTrickle) {
+    std::string how = name + (fTrickle ? " (trickled)" : "");
+    CannedServer server;
+    server.fTrickle = fTrickle;
+    server.Expect(std::vector<std::string>(1, response));
+
+    Client c;
+    Collected collected;
+    HTTPResponse res = streamed(c.client, server.GetPort(), collected);
+    expect(!res.ec && res.nStatus == 200, how, "request failed");
+    expect(collected.received == body, how, "sink got the wrong body");
+    expect(res.body.empty(), how, "body collected as well");
+    if (fTrickle)
+        expect(collected.nCalls > 1, how, "body not handed on as it arrived");
+}
+
+void test_abandon() {
+    const std::string name = "sink abandons the response";
+    CannedServer server;
+    server.fTrickle = true;
+    std::vector<std::string> script;
+    script.push_back("HTTP/1.1 200 OK\r\nContent-Length: 11\r\n\r\nhello world");
+    script.push_back(NEXT);
+    server.Expect(script, false);
+    server.Expect(std::vector<std::string>(1, NEXT));
+
+    Client c;
+    Collected collected;
+    collected.nLimit = 1;
+    HTTPResponse res = streamed(c.client, server.GetPort(), collected);
+    expect(res.ec == boost::system::errc::operation_canceled, name, "not cancelled");
+    expect(collected.nCalls == 1, name, "sink called after giving up");
+
+    // The rest of the body is still on the connection, so it can't be reused.
+    HTTPResponse next = c.client.Request("127.0.0.1", server.GetPort(), HTTPRequest(REQUEST), false).get();
+    expect(!next.ec && next.body == "next", name, "next request failed");
+    expect(c.pool.GetStats().nHits == 0, name, "abandoned connection reused");
+}
+
+HTTPResponse parsed(HTTPRequester &requester, const std::string &port) {
+    HTTPRequest request(REQUEST);
+    request.SetParseJSON(true);
+    return requester.Request("127.0.0.1", port, request, false).get();
+}
+
+void test_parse_json(bool fTrickle) {
+    const std::string text = "{\"login\":\"octocat\",\"id\":1,\"repos\":[{\"name\":\"a\",\"stars\":1.5},{\"name\":\"b\",\"stars\":-2e3}],\"site\":null}";
+    const std::string z = deflate(text);
+    const std::string responses[] = {
+        "HTTP/1.1 200 OK\r\nContent-Length: " + length_of(text) + "\r\n\r\n" + text,
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n" + (boost::format("%x\r\n") % 10).str() + text.substr(0, 10) + "\r\n" + (boost::format("%x\r\n") % (text.size() - 10)).str() + text.substr(10) + "\r\n0\r\n\r\n",
+        "HTTP/1.1 200 OK\r\nContent-Encoding: deflate\r\nContent-Length: " + length_of(z) + "\r\n\r\n" + z,
+    };
+
+    json_spirit::Value expected;
+    json_spirit::read(text, expected);
+    for (std::size_t i = 0; i < sizeof(responses) / sizeof(responses[0]); i++) {
+        std::string name = "parse while downloading " + boost::lexical_cast<std::string>(i) + (fTrickle ? " (trickled)" : "");
+        CannedServer server;
+        server.fTrickle = fTrickle;
+        server.Expect(std::vector<std::string>(1, responses[i]));
+
+        Client c;
+        HTTPResponse res = parsed(c.client, server.GetPort());
+        expect(!res.ec && res.nStatus == 200, name, "request failed");
+        expect(res.json && *res.json == expected, name, "wrong value");
+        expect(res.body == text, name, "body not collected");
+    }
+
+    const std::string bad[] = {
+        "HTTP/1.1 404 Not Found\r\nContent-Length: 11\r\n\r\n{\"a\":\"404\"}",
+        "HTTP/1.1 200 OK\r\nContent-Length: 9\r\n\r\n{\"a\":1,}x",
+    };
+    for (std::size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        std::string name = "not parsed " + boost::lexical_cast<std::string>(i) + (fTrickle ? " (trickled)" : "");
+        CannedServer server;
+        server.fTrickle = fTrickle;
+        server.Expect(std::vector<std::string>(1, bad[i]));
+
+        Client c;
+        HTTPResponse res = parsed(c.client, server.GetPort());
+        expect(!res.ec, name, "request failed");
+        expect(!res.json, name, "parsed anyway");
+    }
+}
+
+void test_not_cached() {
+    const std::string name = "streamed body not cached";
+    CannedServer server;
+    std::vector<std::string> script;
+    script.push_back("HTTP/1.1 200 OK\r\nCache-Control: max-age=60\r\nContent-Length: 5\r\n\r\nfirst");
+    script.push_back("HTTP/1.1 200 OK\r\nCache-Control: max-age=60\r\nContent-Length: 6\r\n\r\nsecond");
+    server.Expect(script);
+
+    Client c;
+    HTTPResponseCache cache;
+    HTTPCachingClient caching(c.client, cache);
+    Collected collected;
+    HTTPResponse res = streamed(caching, server.GetPort(), collected);
+    expect(!res.ec && collected.received == "first", name, "streamed request failed");
+
+    HTTPResponse next = caching.Request("127.0.0.1", server.GetPort(), HTTPRequest(REQUEST), false).get();
+    expect(!next.ec && next.body == "second", name, "answered with the empty streamed body");
+}
+
+int main() {
+    const std::string z = deflate("hello world");
+    for (int fTrickle = 0; fTrickle < 2; fTrickle++) {
+        test_sink("content-length", "HTTP/1.1 200 OK\r\nContent-Length: 11\r\n\r\nhello world", "hello world", fTrickle);
+        test_sink("chunked", "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n", "hello world", fTrickle);
+        test_sink("deflate", "HTTP/1.1 200 OK\r\nContent-Encoding: deflate\r\nContent-Length: " + length_of(z) + "\r\n\r\n" + z, "hello world", fTrickle);
+        test_sink("close-delimited", "HTTP/1.1 200 OK\r\n\r\nhello world", "hello world", fTrickle);
+        test_parse_json(fTrickle);
+    }
+
+    test_abandon();
+    test_not_cached();
+
+    printf("streaming : %s\n", fOk ? "ok" : "failed");
+    return fOk ? 0 : 1;
+}